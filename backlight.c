@@ -0,0 +1,153 @@
+/*************************************************************************
+ * Copyright(c) 2012 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * **************************************************************************/
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "backlight.h"
+
+#define BACKLIGHT_PATH_SIZ	255
+
+static int bl_fd = -1;
+static int ramp_fd = -1;
+static volatile int ramp_target, ramp_step;
+
+int backlight_open(void)
+{
+	char path[BACKLIGHT_PATH_SIZ];
+	struct dirent *entry;
+	DIR *dir;
+	int fd = -1;
+
+	if (bl_fd >= 0)
+		return 0;
+	if ((dir = opendir(SYSFS_BACKLIGHT)) == NULL)
+		return -1;
+	while (fd < 0 && (entry = readdir(dir))) {
+		if (entry->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s/brightness", SYSFS_BACKLIGHT,
+			 entry->d_name);
+		fd = open(path, O_RDWR);
+	}
+	closedir(dir);
+	if (fd < 0) {
+		errno = ENODEV;
+		return -1;
+	}
+	ramp_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	bl_fd = fd;
+	return 0;
+}
+
+int backlight_get(void)
+{
+	char buf[16];
+	int len, level = 0, i;
+
+	if (bl_fd < 0)
+		return -1;
+	len = pread(bl_fd, buf, sizeof(buf) - 1, 0);
+	if (len <= 0)
+		return -1;
+	for (i = 0; i < len && buf[i] >= '0' && buf[i] <= '9'; i++)
+		level = level * 10 + buf[i] - '0';
+	return i ? level : -1;
+}
+
+/* no stdio, this runs in signal handlers */
+static int write_level(int level)
+{
+	char buf[12];
+	int i = sizeof(buf);
+
+	if (level < 0)
+		level = 0;
+	buf[--i] = '\n';
+	do {
+		buf[--i] = '0' + level % 10;
+		level /= 10;
+	} while (level && i > 0);
+	if (pwrite(bl_fd, buf + i, sizeof(buf) - i, 0) < 0)
+		return -1;
+	return 0;
+}
+
+static void ramp_stop(void)
+{
+	struct itimerspec its;
+
+	if (ramp_fd < 0)
+		return;
+	memset(&its, 0, sizeof(its));
+	timerfd_settime(ramp_fd, 0, &its, NULL);
+}
+
+int backlight_set(int level)
+{
+	if (bl_fd < 0)
+		return -1;
+	ramp_stop();
+	return write_level(level);
+}
+
+int backlight_ramp(int level, int step, int interval_ms)
+{
+	struct itimerspec its;
+
+	if (bl_fd < 0 || ramp_fd < 0 || step <= 0)
+		return -1;
+	ramp_target = level;
+	ramp_step = step;
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = its.it_interval.tv_sec = interval_ms / 1000;
+	its.it_value.tv_nsec = its.it_interval.tv_nsec =
+		(interval_ms % 1000) * 1000000L;
+	return timerfd_settime(ramp_fd, 0, &its, NULL);
+}
+
+int backlight_ramp_fd(void)
+{
+	return ramp_fd;
+}
+
+int backlight_ramp_run(void)
+{
+	uint64_t due;
+	int level, delta, target = ramp_target;
+
+	if (read(ramp_fd, &due, sizeof(due)) != sizeof(due))
+		return errno == EAGAIN ? 0 : -1;
+	if ((level = backlight_get()) < 0)
+		return -1;
+	/* catch up on the steps missed */
+	delta = ramp_step * (due > 100 ? 100 : (int) due);
+	if (level < target)
+		level = level + delta < target ? level + delta : target;
+	else if (level > target)
+		level = level - delta > target ? level - delta : target;
+	if (write_level(level) < 0)
+		return -1;
+	if (level != target)
+		return 0;
+	ramp_stop();
+	return 1;
+}
@@ -0,0 +1,49 @@
+/*************************************************************************
+ * Copyright(c) 2012 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * **************************************************************************/
+#ifndef BACKLIGHT_H
+#define BACKLIGHT_H
+
+/*
+ * The panel backlight, shared by the COS, POS and fastboot UIs. The
+ * first device under SYSFS_BACKLIGHT is found once and its brightness
+ * file stays open, so a level change is a single pwrite().
+ *
+ * backlight_get() and backlight_set() only make system calls and may
+ * be used from any thread or from a signal handler.
+ */
+#define SYSFS_BACKLIGHT		"/sys/devices/virtual/backlight"
+
+/* returns 0, or -1 if there is no backlight. later calls do nothing. */
+int backlight_open(void);
+
+/* the current level, or -1 */
+int backlight_get(void);
+
+/* go to level now, cancelling a ramp. returns 0 or -1. */
+int backlight_set(int level);
+
+/*
+ * Move to level by step every interval_ms. The ramp runs on a timerfd:
+ * poll backlight_ramp_fd() and call backlight_ramp_run() when it is
+ * readable.
+ */
+int backlight_ramp(int level, int step, int interval_ms);
+int backlight_ramp_fd(void);
+
+/* do the steps that are due. returns 1 once the target is reached,
+   0 while ramping, -1 on error. */
+int backlight_ramp_run(void);
+
+#endif
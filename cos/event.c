@@ -35,11 +35,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
-#include <pthread.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <sys/reboot.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <time.h>
 
 #include <dirent.h>
 #include <input.h>
@@ -50,688 +51,886 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/reboot.h>
-#include <sys/msg.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/inotify.h>
 
 #include <linux/netlink.h>
 #include <linux/reboot.h>
 
 #include <linux/rtc.h>
 #include "recovery.h"
+#include "power_supply.h"
+#include "uevent.h"
+#include "thermal.h"
+#include "event_ring.h"
+#include "wakeup.h"
+#include "spawn.h"
+#include "backlight.h"
 
-#define SYSFS_POWER_SUPPLY_INT	"/sys/class/power_supply"
 #define SYSFS_VBATT_INT		"/sys/class/power_supply/%s/voltage_now"
 #define SYSFS_CHGER_PRESENT_INT	"/sys/class/power_supply/%s/present"
-#define SYSFS_BACKLIGHT_INT     "/sys/devices/virtual/backlight"
-#define SYSFS_BACKLIGHT_VAL_INT "/sys/devices/virtual/backlight/%s/brightness"
-#define BRIGHT_ON               "60"
-#define BRIGHT_OFF              "0"
-#define MAX_DEVICES             16
+#define BRIGHT_ON               60
+#define BRIGHT_OFF              0
+#define MAX_DEVICES             32
+#define INPUT_DIR		"/dev"
+#define INPUT_BATCH		16
+
+/* from linux/input.h of 4.4, cos/input.h predates it */
+#ifndef EVIOCSMASK
+struct input_mask {
+	__u32 type;
+	__u32 codes_size;
+	__u64 codes_ptr;
+};
+#define EVIOCSMASK		_IOW('E', 0x93, struct input_mask)
+#endif
 #define WAKE_LOCK               "/sys/power/wake_lock"
 #define SCREEN_STATE            "/sys/power/state"
 #define WAKE_UNLOCK             "/sys/power/wake_unlock"
+#define WAKE_LOCK_NAME		"mywakelock"
 #define RTC_FILE	"/dev/rtc0"
-#define SYS_TEMP_INT				"/sys/class/thermal/thermal_zone0/temp"
-#define MAX_TEMP					73000
-
-typedef enum {
-	POWER_SUPPLY_STATUS_CHARGING,
-	POWER_SUPPLY_STATUS_FULL,
-	POWER_SUPPLY_STATUS_COUNT,
-} POWER_SUPPLY_STATUS;
-
-static char *acceptable_status_text[] = {
-	"Charging", "Full"
-};
-
-struct power_supply_status {
-	char path[255];
-	int present;
-	int voltage_now;
-	int current_now;
-	int capacity;
-	int temp;
-	int charge_now;
-	int charge_full;
-	int charge_full_design;
-	POWER_SUPPLY_STATUS charging_status;
-};
-
-static struct power_supply_status charger;
-static struct power_supply_status battery;
-static struct pollfd ev_fds[MAX_DEVICES];
-static unsigned ev_count = 0;
+#define LONG_PRESS_MS		3000
+#define SCREEN_OFF_MS		5000
+#define POWER_OFF_DELAY_MS	5000
+#define THERMAL_OFF_DELAY_MS	5000
+#define TEMP_POLL_MIN_MS	1000
+#define TEMP_POLL_MAX_MS	30000
+#define WAKEUP_DUMP_MS		600000
+/* battery and temperature check while the SoC is suspended */
+#define SUSPEND_CHECK_MS	60000
+
+#ifndef CLOCK_BOOTTIME_ALARM
+#define CLOCK_BOOTTIME_ALARM	9
+#endif
+/* the UI is told when the hottest zone moves by a degree */
+#define TEMP_REPORT_STEP	1000
+
+static struct power_supply charger;
+static struct power_supply battery;
+static struct {
+	int fd;
+	char name[16];		/* eventN */
+} ev_dev[MAX_DEVICES];
+static int ev_epoll = -1;
+static int ev_inotify = -1;
+static __u16 ev_type, ev_code;
+/* the rest of the last batch read from a device */
+static struct input_event ev_buf[INPUT_BATCH];
+static int ev_pos, ev_len;
 static int power_low = 0;
 
-static int msgID;
+static struct event_ring *ring;
 static int boot_mos_flag;
+/* suspend_ok: the kernel has wake locks and alarm timers. suspended:
+   the display is off and "mem" was requested, so the wake lock is only
+   held while there is work to do. */
+static int suspend_ok, suspended, wake_locked;
 
-static struct msgtype {
-	long mtype;
-	char buffer[100];
-} msg;
+static void suspend_enter(void);
+static void suspend_leave(void);
 
 static int is_power_low(void)
 {
 	return power_low;
 }
 
-int event_init(void)
+#define MASK_BIT(bits, n) \
+	((bits)[(n) / (8 * sizeof(long))] |= 1UL << ((n) % (8 * sizeof(long))))
+
+/* restrict what the kernel queues for us to ev_type/ev_code. kernels
+   without EVIOCSMASK still work, event_get() filters the rest. */
+static void event_set_mask(int fd)
 {
-	DIR *dir;
-	struct dirent *de;
-	int fd;
-	dir = opendir("/dev");
-	if (dir != 0) {
-		while ((de = readdir(dir))) {
-			if (strncmp(de->d_name, "event", 5))
-				continue;
-			fd = openat(dirfd(dir), de->d_name, O_RDONLY);
-			if (fd < 0)
-				continue;
+	unsigned long bits[KEY_MAX / (8 * sizeof(long)) + 1];
+	struct input_mask mask;
+	unsigned types[2] = { 0, ev_type };
+	int i;
 
-			ev_fds[ev_count].fd = fd;
-			ev_fds[ev_count].events = POLLIN;
-			ev_count++;
-			if (ev_count == MAX_DEVICES)
-				break;
+	/* the type 0 mask selects the event types, EV_SYN always passes
+	   and the types left out are dropped whole. only ev_type needs a
+	   code mask of its own. */
+	for (i = 0; i < 2; i++) {
+		memset(bits, 0, sizeof(bits));
+		MASK_BIT(bits, i == 0 ? ev_type : ev_code);
+		mask.type = types[i];
+		mask.codes_size = sizeof(bits);
+		mask.codes_ptr = (uintptr_t)bits;
+		if (ioctl(fd, EVIOCSMASK, &mask) < 0) {
+			if (errno != ENOTTY)
+				syslog(LOG_ERR, "EVIOCSMASK type %u: %s\n",
+				       types[i], strerror(errno));
+			return;
 		}
 	}
-	return 0;
 }
 
-int event_wait(struct input_event *ev, unsigned dont_wait, __u16 type,
-	       __u16 code, __s32 value)
+/* open the devices that can report ev_type/ev_code and hand out only
+   those events. a power button is not woken up by the touchscreen. */
+static void event_open(const char *name)
 {
-	int r = 0;
-	unsigned n;
-
-	do {
-		r = poll(ev_fds, ev_count, dont_wait ? 0 : -1);
-		if (r > 0) {
-			for (n = 0; n < ev_count; n++) {
-				if (ev_fds[n].revents & POLLIN) {
-					r = read(ev_fds[n].fd, ev, sizeof(*ev));
-					if (r == sizeof(*ev) && ev->type == type
-					    && ev->code == code
-					    && ev->value == value)
-						return 0;
-				}
-			}
-		}
-	} while (dont_wait == 0);
+	unsigned long bits[KEY_MAX / (8 * sizeof(long)) + 1];
+	struct epoll_event ep;
+	char path[32];
+	int i, slot = -1, fd;
+
+	if (strncmp(name, "event", 5))
+		return;
+	for (i = 0; i < MAX_DEVICES; i++) {
+		if (ev_dev[i].fd < 0) {
+			if (slot < 0)
+				slot = i;
+		} else if (!strcmp(ev_dev[i].name, name))
+			return;
+	}
+	if (slot < 0) {
+		syslog(LOG_WARNING, "too many input devices, ignoring %s\n", name);
+		return;
+	}
+
+	snprintf(path, sizeof(path), INPUT_DIR "/%s", name);
+	fd = open(path, O_RDONLY | O_NONBLOCK);
+	if (fd < 0)
+		return;
+	memset(bits, 0, sizeof(bits));
+	if (ioctl(fd, EVIOCGBIT(ev_type, sizeof(bits)), bits) >= 0 &&
+	    !(bits[ev_code / (8 * sizeof(long))] &
+	      (1UL << (ev_code % (8 * sizeof(long)))))) {
+		close(fd);
+		return;
+	}
+	event_set_mask(fd);
+
+	memset(&ep, 0, sizeof(ep));
+	ep.events = EPOLLIN;
+	ep.data.u32 = slot;
+	if (epoll_ctl(ev_epoll, EPOLL_CTL_ADD, fd, &ep) < 0) {
+		close(fd);
+		return;
+	}
+	ev_dev[slot].fd = fd;
+	snprintf(ev_dev[slot].name, sizeof(ev_dev[slot].name), "%s", name);
+}
 
-	return -1;
+static void event_close(int slot)
+{
+	/* closing the fd also takes it out of the epoll set */
+	close(ev_dev[slot].fd);
+	ev_dev[slot].fd = -1;
 }
 
-char *get_brightness_path(void)
+static void event_hotplug(void)
 {
-	struct dirent *entry;
-	DIR *dir;
-	const char *name;
-	char *path;
-
-	dir = opendir(SYSFS_BACKLIGHT_INT);
-	if (dir == NULL) {
-		syslog(LOG_ERR, "Could not open %s\n", SYSFS_BACKLIGHT_INT);
-		return NULL;
-	}
-	while ((entry = readdir(dir))) {
-		name = entry->d_name;
-		path =
-		    malloc(strlen(SYSFS_BACKLIGHT_VAL_INT) + strlen(name) + 1);
-		sprintf(path, SYSFS_BACKLIGHT_VAL_INT, name);
-
-		if (access(path, 0) == 0) {
-			closedir(dir);
-			return path;
+	char buf[1024];
+	struct inotify_event *ie;
+	int len, off, i;
+
+	while ((len = read(ev_inotify, buf, sizeof(buf))) > 0) {
+		for (off = 0; off < len; off += sizeof(*ie) + ie->len) {
+			ie = (struct inotify_event *)(buf + off);
+			if (!ie->len)
+				continue;
+			if (ie->mask & IN_CREATE) {
+				event_open(ie->name);
+				continue;
+			}
+			for (i = 0; i < MAX_DEVICES; i++)
+				if (ev_dev[i].fd >= 0 &&
+				    !strcmp(ev_dev[i].name, ie->name))
+					event_close(i);
 		}
 	}
-	closedir(dir);
-	return NULL;
 }
 
-int get_back_brightness(void)
+int event_init(__u16 type, __u16 code)
 {
-	FILE *file;
-	int bright = -1;
-	char *str;
+	struct epoll_event ep;
+	struct dirent *de;
+	DIR *dir;
+	int i;
 
-	str = get_brightness_path();
+	if (ev_epoll >= 0)
+		return ev_epoll;
+	ev_type = type;
+	ev_code = code;
+	for (i = 0; i < MAX_DEVICES; i++)
+		ev_dev[i].fd = -1;
+	if ((ev_epoll = epoll_create(MAX_DEVICES + 1)) < 0)
+		return -1;
 
-	if ((file = fopen(str, "r+")) != NULL) {
-		fscanf(file, "%d", &bright);
-		fclose(file);
-	} else {
-		syslog(LOG_ERR, "Can't open brightness file!\n");
+	/* watch before the scan so a device added in between is not lost */
+	ev_inotify = inotify_init();
+	if (ev_inotify >= 0) {
+		fcntl(ev_inotify, F_SETFL, O_NONBLOCK);
+		memset(&ep, 0, sizeof(ep));
+		ep.events = EPOLLIN;
+		ep.data.u32 = MAX_DEVICES;
+		if (inotify_add_watch(ev_inotify, INPUT_DIR, IN_CREATE | IN_DELETE) < 0 ||
+		    epoll_ctl(ev_epoll, EPOLL_CTL_ADD, ev_inotify, &ep) < 0) {
+			close(ev_inotify);
+			ev_inotify = -1;
+		}
 	}
+	if (ev_inotify < 0)
+		syslog(LOG_WARNING, "no input hotplug on %s\n", INPUT_DIR);
 
-	return bright;
+	dir = opendir(INPUT_DIR);
+	if (dir != 0) {
+		while ((de = readdir(dir)))
+			event_open(de->d_name);
+		closedir(dir);
+	}
+	return ev_epoll;
 }
 
-static int set_back_brightness(char *bright_val)
+int event_get(struct input_event *ev, int timeout_ms)
 {
-	int ret = 0;
-	char *str;
-	FILE *file;
+	struct epoll_event ready;
+	int n, r, slot;
 
-	str = get_brightness_path();
+	for (;;) {
+		while (ev_pos < ev_len) {
+			*ev = ev_buf[ev_pos++];
+			if (ev->type == ev_type && ev->code == ev_code)
+				return 0;
+		}
 
-	if ((file = fopen(str, "w+")) != NULL) {
-		fwrite(bright_val, (strlen(bright_val) + 1), 1, file);
-		fclose(file);
-		ret = 1;
+		/* one source at a time, level triggering brings the others
+		   back on the next round */
+		n = epoll_wait(ev_epoll, &ready, 1, timeout_ms);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		slot = ready.data.u32;
+		if (slot == MAX_DEVICES) {
+			event_hotplug();
+			continue;
+		}
+		r = read(ev_dev[slot].fd, ev_buf, sizeof(ev_buf));
+		if (r < 0 && (errno == EAGAIN || errno == EINTR))
+			continue;
+		if (r <= 0) {
+			/* unplugged before inotify told us */
+			event_close(slot);
+			continue;
+		}
+		ev_pos = 0;
+		ev_len = r / sizeof(ev_buf[0]);
 	}
-
-	return ret;
 }
 
-int turn_off_screen()
+int event_wait(struct input_event *ev, unsigned dont_wait, __u16 type,
+	       __u16 code, __s32 value)
 {
-	FILE *file;
-	int ret = 0;
-
-	if ((file = fopen(WAKE_LOCK, "w")) != NULL) {
-		fwrite("mywakelock\n", (strlen("mywakelock") + 1), 1, file);
-		fclose(file);
-		ret = 1;
-	} else {
-		syslog(LOG_ERR, "wake lock open error\n");
-		ret = -1;
-		goto err;
+	while (event_get(ev, dont_wait ? 0 : -1) == 0) {
+		if (ev->type == type && ev->code == code && ev->value == value)
+			return 0;
 	}
+	return -1;
+}
 
-	if ((file = fopen(SCREEN_STATE, "w")) != NULL) {
-		fwrite("mem\n", (strlen("mem") + 1), 1, file);
-		fclose(file);
-		ret = 1;
-	} else {
-		syslog(LOG_ERR, "screen state open error\n");
-		ret = -1;
+/* the SoC suspends once "mem" is requested and no wake lock is held */
+int turn_off_screen()
+{
+	if (sysfs_write(SCREEN_STATE, "mem") < 0) {
+		syslog(LOG_ERR, "screen state write error\n");
+		return -1;
 	}
-
-err:
-	return ret;
+	return 1;
 }
 
 int turn_on_screen()
 {
-	FILE *file;
-	int ret = 0;
-
-	if ((file = fopen(SCREEN_STATE, "w")) != NULL) {
-		fwrite("on\n", (strlen("on") + 1), 1, file);
-		fclose(file);
-		ret = 1;
-	} else {
-		syslog(LOG_ERR, "screen state open error\n");
-		ret = -1;
-		goto err;
+	if (sysfs_write(SCREEN_STATE, "on") < 0) {
+		syslog(LOG_ERR, "screen state write error\n");
+		return -1;
 	}
+	return 1;
+}
 
-	if ((file = fopen(WAKE_UNLOCK, "w")) != NULL) {
-		fwrite("mywakelock\n", (strlen("mywakelock") + 1), 1, file);
-		fclose(file);
-		ret = 1;
-	} else {
-		syslog(LOG_ERR, "wake unlock open error\n");
-		ret = -1;
-	}
-err:
-	return ret;
+static void wake_lock(int hold)
+{
+	if (hold == wake_locked)
+		return;
+	if (sysfs_write(hold ? WAKE_LOCK : WAKE_UNLOCK, WAKE_LOCK_NAME) < 0)
+		syslog(LOG_ERR, "wake %s write error\n", hold ? "lock" : "unlock");
+	else
+		wake_locked = hold;
 }
 
 int set_power_on_reason(int alarm_rang)
 {
-	unsigned char rbt_reason;
-	int devfd = 0, errNo = 0, ret;
-
-	rbt_reason = RR_SIGNED_MOS;
-
-	if ((devfd = open(IPC_DEVICE_NAME, O_RDWR)) < 0) {
-		syslog(LOG_ERR, "unable to open the DEVICE %s\n",
-			IPC_DEVICE_NAME);
-		ret = 0;
-		goto err1;
-	}
-
-	if ((errNo = ioctl(devfd, IPC_WRITE_RR_TO_OSNIB, &rbt_reason)) < 0) {
+	if (scu_ipc_write_rr(RR_SIGNED_MOS) < 0) {
 		syslog(LOG_ERR,
 			"ioctl for DEVICE %s, returns error-%d\n",
-			IPC_DEVICE_NAME, errNo);
-		ret = 0;
-		goto err2;
+			IPC_DEVICE_NAME, errno);
+		return 0;
 	}
 
 	if (alarm_rang)
 		syslog(LOG_NOTICE, "RTC Alarm Fired ...\n");
 	else
 		syslog(LOG_NOTICE, "Clear the alarm flag here ...\n");
-	if ((errNo = ioctl(devfd, IPC_WRITE_ALARM_TO_OSNIB, &alarm_rang)) < 0) {
+	if (scu_ipc_write_alarm(alarm_rang) < 0) {
 		syslog(LOG_ERR,
 			"ioctl for DEVICE %s, returns error-%d\n",
-			IPC_DEVICE_NAME, errNo);
-		ret = 0;
-		goto err2;
+			IPC_DEVICE_NAME, errno);
+		return 0;
 	}
-	ret = 1;
-err2:
-	close(devfd);
-err1:
-	return ret;
+	return 1;
 }
 
 void on_display()
 {
-	/* Commented this out due to RUNTIME_PM still cause random reboot.
-	   Will uncomment this after enabling RUNTIME_PM.
-	   turn_on_screen(); */
-	set_back_brightness(BRIGHT_ON);
+	suspend_leave();
+	backlight_set(BRIGHT_ON);
+	event_ring_post(ring, EVENT_SCREEN, 1);
 }
 
 void off_display()
 {
-	set_back_brightness(BRIGHT_OFF);
-	/* Commented this out due to RUNTIME_PM still cause random reboot.
-	   Will uncomment this after enabling RUNTIME_PM.
-	   turn_off_screen(); */
+	event_ring_post(ring, EVENT_SCREEN, 0);
+	backlight_set(BRIGHT_OFF);
+	suspend_enter();
 }
 
 void boot_android()
 {
 	if (!is_power_low() && set_power_on_reason(0)) {
 		syslog(LOG_NOTICE, "release power button reboot to MOS\n");
-		msg.mtype = COS_BOOT_MOS;
-		strcpy(msg.buffer, COS_BOOT_MOS_BUF);
-		msgsnd(msgID, &msg, sizeof(struct msgtype), 0);
+		event_ring_post(ring, EVENT_BOOT_MOS, 1);
 		boot_mos_flag = 1;
 		on_display();
 	}
 }
 
-static void try_read_property(char *src, char *prop_name, int *value)
+/* refresh the battery. returns -1 if it cannot be read, or if the
+   charger is in and the battery is neither charging nor full. */
+static int get_battery_status(int *changed)
 {
-	char *res = strstr(src, prop_name);
-	if (res) {
-		/*skip prop_name and '=' */
-		res += strlen(prop_name) + 1;
-		*value = atoi(res);
-	}
-}
+	int ret;
 
-static int get_power_supply_status(struct power_supply_status *status)
-{
-	FILE *f = fopen(status->path, "r");
-	char buf[256];
-	char *res;
-	int ret = 0;
-	POWER_SUPPLY_STATUS i;
-
-	if (f == NULL) {
-		syslog(LOG_ERR, "unable to open status file\n");
+	ret = power_supply_read(&battery);
+	if (ret < 0) {
+		syslog(LOG_ERR, "unable to read %s\n", battery.path);
 		return -1;
 	}
-	while (fgets(buf, 256, f)) {
-		try_read_property(buf, "PRESENT", &status->present);
-		try_read_property(buf, "VOLTAGE_NOW", &status->voltage_now);
-		try_read_property(buf, "CURRENT_NOW", &status->current_now);
-		try_read_property(buf, "CAPACITY", &status->capacity);
-		try_read_property(buf, "TEMP", &status->temp);
-		try_read_property(buf, "CHARGE_NOW", &status->charge_now);
-		try_read_property(buf, "CHARGE_FULL", &status->charge_full);
-		try_read_property(buf, "CHARGE_FULL_DESIGN",
-				  &status->charge_full_design);
-		res = strstr(buf, "STATUS");
-                if (res && charger.present) {
-			res += strlen("STATUS") + 1;
-			for (i = 0; i < POWER_SUPPLY_STATUS_COUNT; i++) {
-				if (strncmp(res, acceptable_status_text[i],
-						strlen(acceptable_status_text[i])) == 0) {
-					status->charging_status = i;
-					break;
-				}
-			}
-			if (i >= POWER_SUPPLY_STATUS_COUNT) {
-				syslog(LOG_ERR, "Abnormal status: %s\n", res);
-				ret = -1;
-			}
-		}
-
+	if (changed)
+		*changed |= ret;
+	if (charger.st.present &&
+	    battery.st.status != POWER_SUPPLY_STATUS_CHARGING &&
+	    battery.st.status != POWER_SUPPLY_STATUS_FULL) {
+		if (ret & (PS_STATUS | PS_PRESENT))
+			syslog(LOG_ERR, "Abnormal status: %s\n",
+				power_supply_status_text(battery.st.status));
+		return -1;
 	}
-	fclose(f);
-	return ret;
+	return 0;
 }
 
 /* Get the IA_APPS_RUN in uV from the SMIP */
 static int get_voltage_gate()
 {
-	int devfd, errNo;
-	unsigned int read_buf;
-	unsigned int voltage_gate, ret = 0;
+	unsigned int voltage_gate;
 
-	if ((devfd = open(IPC_DEVICE_NAME, O_RDWR)) < 0) {
-		syslog(LOG_ERR, "unable to open the DEVICE %s\n",
-			IPC_DEVICE_NAME);
-		ret = 0;
-		goto err1;
+	if (scu_ipc_voltage_gate(&voltage_gate) < 0) {
+		syslog(LOG_ERR, "unable to read VBATTCRIT from %s: %s\n",
+			IPC_DEVICE_NAME, strerror(errno));
+		return 0;
 	}
+	return voltage_gate;
+}
 
-	if ((errNo = ioctl(devfd, IPC_READ_VBATTCRIT, &read_buf)) < 0) {
-		syslog(LOG_ERR, "ioctl for DEVICE %s, returns error-%d\n",
-			IPC_DEVICE_NAME, errNo);
-		ret = 0;
-		goto err2;
-	}
+/* one fd of the event loop, handle() is called when it is readable */
+struct cos_source {
+	int fd;
+	void (*handle)(struct cos_source *src);
+	struct wakeup_source ws;
+};
+
+#define COS_SOURCE(_id, _name)	{ .fd = -1, .ws = WAKEUP_SOURCE_INIT(_id, _name) }
+
+static int epoll_fd = -1;
+static struct cos_source input_src = COS_SOURCE(WAKEUP_COS_INPUT, "input");
+static struct cos_source power_src =
+	COS_SOURCE(WAKEUP_COS_POWER_UEVENT, "power_uevent");
+static struct cos_source power_timer_src =
+	COS_SOURCE(WAKEUP_COS_POWER_REFRESH, "power_refresh");
+static struct cos_source power_off_src =
+	COS_SOURCE(WAKEUP_COS_POWER_OFF, "power_off");
+static struct cos_source rtc_src = COS_SOURCE(WAKEUP_COS_RTC, "rtc_alarm");
+static struct cos_source thermal_src =
+	COS_SOURCE(WAKEUP_COS_THERMAL_UEVENT, "thermal_uevent");
+static struct cos_source temp_timer_src =
+	COS_SOURCE(WAKEUP_COS_THERMAL_TIMER, "temp_timer");
+static struct cos_source thermal_off_src =
+	COS_SOURCE(WAKEUP_COS_THERMAL_OFF, "thermal_off");
+static struct cos_source longpress_src =
+	COS_SOURCE(WAKEUP_COS_LONGPRESS, "longpress");
+static struct cos_source screen_off_src =
+	COS_SOURCE(WAKEUP_COS_SCREEN_OFF, "screen_off");
+static struct cos_source dump_src = COS_SOURCE(WAKEUP_COS_DUMP, "wakeup_dump");
+static struct cos_source check_src =
+	COS_SOURCE(WAKEUP_COS_SUSPEND_CHECK, "suspend_check");
+static struct uevent_listener power_ul, thermal_ul;
+static int voltage_gate;
+
+static int add_source(struct cos_source *src, int fd,
+		      void (*handle)(struct cos_source *))
+{
+	struct epoll_event ev;
+
+	src->fd = fd;
+	src->handle = handle;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+#ifdef EPOLLWAKEUP
+	/* keep the SoC up until the event is served and the wake lock
+	   taken again */
+	ev.events |= EPOLLWAKEUP;
+#endif
+	ev.data.ptr = src;
+	return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void del_source(struct cos_source *src)
+{
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, src->fd, NULL);
+	close(src->fd);
+	src->fd = -1;
+}
+
+/* one-shot timer, ms = 0 disarms it */
+static void timer_arm(struct cos_source *src, int ms)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = ms / 1000;
+	its.it_value.tv_nsec = (ms % 1000) * 1000000L;
+	timerfd_settime(src->fd, 0, &its, NULL);
+}
+
+static int timer_armed(struct cos_source *src)
+{
+	struct itimerspec its;
 
-	/*The VBATTCRIT value is the 2nd 2-bytes of this 4-bytes */
-	voltage_gate = read_buf >> 16;
-	/* Change mV to uV to align with the current voltage read from sysfs interface */
-	ret = voltage_gate * 1000;
-err2:
-	close(devfd);
-err1:
-	return ret;
+	return timerfd_gettime(src->fd, &its) == 0 &&
+	       (its.it_value.tv_sec || its.it_value.tv_nsec);
 }
 
-static int readFromFile(const char *path, char *buf, size_t size)
+static void timer_ack(struct cos_source *src)
 {
-	if (!path)
+	uint64_t expired;
+
+	read(src->fd, &expired, sizeof(expired));
+}
+
+static int add_clock_timer(struct cos_source *src, int clock,
+			   void (*handle)(struct cos_source *))
+{
+	int fd = timerfd_create(clock, TFD_NONBLOCK);
+
+	if (fd < 0)
 		return -1;
-	int fd = open(path, O_RDONLY, 0);
-	if (fd == -1) {
-		syslog(LOG_ERR, "Could not open '%s'", path);
+	if (add_source(src, fd, handle) < 0) {
+		close(fd);
 		return -1;
 	}
-	size_t count = read(fd, buf, size);
-	if (count > 0) {
-		count = (count < size) ? count : size - 1;
-		while (count > 0 && buf[count - 1] == '\n')
-			count--;
-		buf[count] = '\0';
-	} else {
-		buf[0] = '\0';
-	}
-	close(fd);
-	return count;
+	return 0;
 }
 
-/* find a power_supply that is of given type in sysfs
-   retry for 4 sec until found.
- */
-static int find_power_supply(struct power_supply_status *st, char *type)
+static int add_timer(struct cos_source *src,
+		     void (*handle)(struct cos_source *))
 {
-	DIR *pDir;
-	struct dirent *ent = NULL;
-	char path[255], buf[255];
-	int i;
-	for (i = 0; i < 40; i++) {
-		pDir = opendir(SYSFS_POWER_SUPPLY_INT);
-		while ((ent = readdir(pDir)) != NULL) {
-			snprintf(path, 255, SYSFS_POWER_SUPPLY_INT "/%s/type",
-				 ent->d_name);
-			if (readFromFile(path, buf, 255) > 0
-			    && strstr(buf, type) != NULL) {
-				snprintf(st->path, 255,
-					 SYSFS_POWER_SUPPLY_INT "/%s/uevent",
-					 ent->d_name);
-				return 0;
-			}
-			syslog(LOG_ERR, "non matching power_supply %s != %s\n",
-				buf, type);
-		}
-		usleep(100000);
-	}
-	syslog(LOG_ERR, "did not find power_supply %s\n", type);
-	return -ENOENT;
+	return add_clock_timer(src, CLOCK_MONOTONIC, handle);
+}
+
+static void power_off_expired(struct cos_source *src)
+{
+	timer_ack(src);
+	reboot(LINUX_REBOOT_CMD_POWER_OFF);
 }
 
-static void *power_off_task(void *arg)
+static void schedule_power_off(void)
 {
 	syslog(LOG_NOTICE, "Charger removal or abnormal status detected ...\n");
 	syslog(LOG_NOTICE, "It will shutdown in 5s ...\n");
-	sleep(5);
-	reboot(LINUX_REBOOT_CMD_POWER_OFF);
-	return NULL;
+	timer_arm(&power_off_src, POWER_OFF_DELAY_MS);
 }
 
-static void update_status(int voltage_gate)
+static void post_battery(void)
 {
-	msg.mtype = COS_BAT_STATUS;
-	if (battery.charging_status == POWER_SUPPLY_STATUS_FULL)
-		sprintf(msg.buffer, "%s", "FULL");
+	if (battery.st.status == POWER_SUPPLY_STATUS_FULL)
+		event_ring_post(ring, EVENT_BATTERY, EVENT_BATTERY_FULL);
 	else
-		sprintf(msg.buffer, "%d", battery.capacity);
-	msgsnd(msgID, &msg, sizeof(struct msgtype), 0);
-
-	if (battery.voltage_now < voltage_gate) {
-		power_low = 1;
-		msg.mtype = COS_VOL_GATE;
-		strcpy(msg.buffer, COS_VOL_LOW);
-		msgsnd(msgID, &msg,
-			sizeof(struct msgtype), 0);
-	} else {
-		power_low = 0;
-		msg.mtype = COS_VOL_GATE;
-		strcpy(msg.buffer, COS_VOL_HIGH);
-		msgsnd(msgID, &msg,
-			sizeof(struct msgtype), 0);
-	}
-
+		event_ring_post(ring, EVENT_BATTERY, battery.st.capacity);
 }
 
-/* thread to monitor the power supply */
-void *power_monitor_event(void *arg)
+/* the ring drops values the UI already has */
+static void update_status(int voltage_gate)
 {
-	struct sockaddr_nl nls;
-	struct pollfd pfd;
-	char buf[512];
-	int voltage_gate;
-	pthread_t thr;
-	pthread_attr_t atr;
-	int schedule_flag = 0;
-
-	syslog(LOG_DEBUG, "power_monitor_event thread created ...\n");
-	if ((voltage_gate = get_voltage_gate()) < 0) {
-		syslog(LOG_ERR, "Get voltage gate error!\n");
-		return NULL;
-	}
+	post_battery();
+	power_low = battery.st.voltage_now < voltage_gate;
+	event_ring_post(ring, EVENT_GATE, !power_low);
+}
 
-	memset(&nls, 0, sizeof(struct sockaddr_nl));
-	nls.nl_family = AF_NETLINK;
-	nls.nl_pid = getpid();
-	nls.nl_groups = -1;
+/* a charger plug-in fires a burst of events, refresh once per burst */
+static void power_uevent(struct cos_source *src)
+{
+	if (uevent_wait(&power_ul, 0, 0) > 0 && !timer_armed(&power_timer_src))
+		timer_arm(&power_timer_src, UEVENT_DEBOUNCE_MS);
+}
 
-	pfd.events = POLLIN;
-	pfd.fd = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT);
+static void power_check(void)
+{
+	int battery_ok, changed;
+	int power_off = timer_armed(&power_off_src);
 
-	if (bind(pfd.fd, (void *)&nls, sizeof(struct sockaddr_nl))) {
-		syslog(LOG_ERR, "Bind failed\n");
-		return NULL;
+	changed = power_supply_read(&charger);
+	battery_ok = get_battery_status(&changed) == 0;
+	if ((!battery_ok || !charger.st.present) && !power_off) {
+		schedule_power_off();
+		power_off = 1;
+		event_ring_post(ring, EVENT_CHARGER, 0);
 	}
-
-	if (pthread_attr_init(&atr) != 0) {
-		syslog(LOG_ERR, "ERROR: Unable to set event thread attribute.\n");
-		return NULL;
+	if (battery_ok && charger.st.present && power_off) {
+		syslog(LOG_NOTICE, "Back to charging status ...\n");
+		timer_arm(&power_off_src, 0);
+		power_off = 0;
+		event_ring_post(ring, EVENT_CHARGER, 1);
 	}
 
-	get_power_supply_status(&charger);
-	if ((get_power_supply_status(&battery) < 0 || !charger.present) && !schedule_flag) {
-		if (pthread_create(&thr, &atr, power_off_task, NULL) != 0)
-			syslog(LOG_ERR, "ERROR: Unable to create power_off_task thread.\n");
-		else {
-			schedule_flag = 1;
-			msg.mtype = COS_CHRG_EVENT;
-			strcpy(msg.buffer, COS_CHRG_REMOVE);
-			msgsnd(msgID, &msg, sizeof(struct msgtype), 0);
+	/* nothing to tell the UI if no value moved */
+	if (!power_off && changed)
+		update_status(voltage_gate);
+}
 
-			msg.mtype = COS_BAT_STATUS;
-			if (battery.charging_status == POWER_SUPPLY_STATUS_FULL)
-				sprintf(msg.buffer, "%s", "FULL");
-			else
-				sprintf(msg.buffer, "%d", battery.capacity);
-			msgsnd(msgID, &msg, sizeof(struct msgtype), 0);
+static void power_refresh(struct cos_source *src)
+{
+	timer_ack(src);
+	power_check();
+}
 
-		}
+static int power_monitor_init(void)
+{
+	voltage_gate = get_voltage_gate();
+	if (add_timer(&power_off_src, power_off_expired) < 0 ||
+	    add_timer(&power_timer_src, power_refresh) < 0) {
+		syslog(LOG_ERR, "unable to create power timers\n");
+		return -1;
 	}
+	if (uevent_open(&power_ul, "power_supply")) {
+		syslog(LOG_ERR, "Bind failed\n");
+		return -1;
+	}
+	add_source(&power_src, power_ul.fd, power_uevent);
 
-	if (!schedule_flag)
+	power_supply_read(&charger);
+	if (get_battery_status(NULL) < 0 || !charger.st.present) {
+		schedule_power_off();
+		event_ring_post(ring, EVENT_CHARGER, 0);
+		post_battery();
+	} else
 		update_status(voltage_gate);
-
-	while (-1 != poll(&pfd, 1, -1)) {
-		int i, len = recv(pfd.fd, buf, sizeof(buf), MSG_DONTWAIT);
-		if (len == -1) {
-			syslog(LOG_ERR, "receive failed \n");
-			break;
-		}
-		i = 0;
-
-		while (i < len) {
-			i += strlen(buf + i) + 1;
-			if (!strncmp
-			    (buf + i, "SUBSYSTEM=power_supply",
-			     strlen("SUBSYSTEM=power_supply"))) {
-
-				get_power_supply_status(&charger);
-				if ((get_power_supply_status(&battery) < 0 || !charger.present) && !schedule_flag) {
-					if (pthread_create(&thr, &atr, power_off_task, NULL) != 0)
-						syslog(LOG_ERR, "ERROR: Unable to create power_off_press thread.\n");
-					else {
-						schedule_flag = 1;
-						msg.mtype = COS_CHRG_EVENT;
-						strcpy(msg.buffer, COS_CHRG_REMOVE);
-						msgsnd(msgID, &msg, sizeof(struct msgtype), 0);
-					}
-
-				}
-				if (!get_power_supply_status(&battery) && charger.present && schedule_flag) {
-					syslog(LOG_NOTICE, "Back to charging status ...\n");
-					pthread_cancel(thr);
-					schedule_flag = 0;
-					msg.mtype = COS_CHRG_EVENT;
-					strcpy(msg.buffer, COS_CHRG_INSERT);
-					msgsnd(msgID, &msg, sizeof(struct msgtype), 0);
-				}
-
-				if (!schedule_flag)
-					update_status(voltage_gate);
-
-				break;
-			}
-		}
-	}
-	return NULL;
+	return 0;
 }
 
-void *powerbtn_event(void *arg)
+static long press_ms(const struct input_event *ev)
 {
-	int bright_val = 0;
-	struct input_event ev;
-
-	syslog(LOG_DEBUG, "powerbtn_event thread created ...\n");
-
-	event_init();
-	boot_mos_flag = 0;
-	signal(SIGALRM, off_display);
-	alarm(5);
+	return ev->time.tv_sec * 1000L + ev->time.tv_usec / 1000;
+}
 
-	do {
-		event_wait(&ev, 0, EV_KEY, KEY_POWER, 1);
+static void power_key(const struct input_event *ev)
+{
+	static int bright_val;
+	static long pressed_at;
 
-		alarm(0);
-		bright_val = get_back_brightness();
+	if (ev->value == 1) {
+		timer_arm(&screen_off_src, 0);
+		bright_val = backlight_get();
 		if (bright_val < 0)
-			continue;
-
+			return;
 		if (bright_val == 0)
 			on_display();
-
-		signal(SIGALRM, boot_android);
-		alarm(3);
-		event_wait(&ev, 0, EV_KEY, KEY_POWER, 0);
-		alarm(0);
+		pressed_at = press_ms(ev);
+		timer_arm(&longpress_src, LONG_PRESS_MS);
+	} else if (ev->value == 0) {
+		timer_arm(&longpress_src, 0);
+		if (bright_val < 0)
+			return;
+		/* the timer may not have been served yet, the key
+		   timestamps tell how long it really was held */
+		if (!boot_mos_flag && press_ms(ev) - pressed_at >= LONG_PRESS_MS)
+			boot_android();
 		if (boot_mos_flag) {
 			syslog(LOG_INFO, "Now reboot to MOS ...\n");
 			boot_mos_flag = 0;
 			reboot(LINUX_REBOOT_CMD_RESTART);
 		} else if (bright_val != 0)
 			off_display();
-		else {
-			signal(SIGALRM, off_display);
-			alarm(5);
-		}
-	} while (1);
+		else
+			timer_arm(&screen_off_src, SCREEN_OFF_MS);
+	}
+}
+
+static void input_ready(struct cos_source *src)
+{
+	struct input_event ev;
 
-	return NULL;
+	while (event_get(&ev, 0) == 0)
+		power_key(&ev);
 }
 
-void *rtc_alarm_event(void *arg)
+static void longpress_expired(struct cos_source *src)
+{
+	timer_ack(src);
+	boot_android();
+}
+
+static void screen_off_expired(struct cos_source *src)
+{
+	timer_ack(src);
+	off_display();
+}
+
+static int powerbtn_init(void)
+{
+	int fd;
+
+	if (add_timer(&longpress_src, longpress_expired) < 0 ||
+	    add_timer(&screen_off_src, screen_off_expired) < 0) {
+		syslog(LOG_ERR, "unable to create power button timers\n");
+		return -1;
+	}
+	/* the input epoll set nests in ours, hotplug included */
+	if ((fd = event_init(EV_KEY, KEY_POWER)) < 0 ||
+	    add_source(&input_src, fd, input_ready) < 0)
+		syslog(LOG_ERR, "unable to watch the input devices\n");
+	boot_mos_flag = 0;
+	timer_arm(&screen_off_src, SCREEN_OFF_MS);
+	return 0;
+}
+
+static void rtc_alarm(struct cos_source *src)
 {
 	unsigned long data;
-	int rtc_fd, ret;
+
+	if (read(src->fd, &data, sizeof(unsigned long)) < 0) {
+		syslog(LOG_ERR, "rtc read error\n");
+		del_source(src);
+		return;
+	}
+	syslog(LOG_NOTICE, "RTC Alarm rang.Now reboot to MOS ...\n");
+	if (!is_power_low() && set_power_on_reason(1))
+		reboot(LINUX_REBOOT_CMD_RESTART);
+	/* the alarm is only honoured once */
+	del_source(src);
+}
+
+static void rtc_alarm_init(void)
+{
+	int rtc_fd;
 
 	rtc_fd = open(RTC_FILE, O_RDONLY, 0);
 	if (rtc_fd < 0) {
 		syslog(LOG_ERR, "unable to open the DEVICE %s\n", RTC_FILE);
-		goto err1;
+		return;
 	}
 	/* Enable alarm interrupts */
-	ret = ioctl(rtc_fd, RTC_AIE_ON, 0);
-	if (ret == -1) {
+	if (ioctl(rtc_fd, RTC_AIE_ON, 0) == -1) {
 		syslog(LOG_ERR, "rtc ioctl RTC_AIE_ON error\n");
-		goto err2;
+		close(rtc_fd);
+		return;
 	}
+	add_source(&rtc_src, rtc_fd, rtc_alarm);
+}
 
-	/* This blocks until the alarm ring causes an interrupt */
-	ret = read(rtc_fd, &data, sizeof(unsigned long));
-	if (ret < 0) {
-		syslog(LOG_ERR, "rtc read error\n");
-		goto err2;
+/* time to the next sample: about a quarter of the time the zone needs
+   to reach its limit at the current rate, and never more than 1 s per
+   degree of headroom, so a cool device is barely woken up */
+static int temp_poll_ms(int headroom, int rise)
+{
+	int ms = TEMP_POLL_MAX_MS;
+
+	if (rise > 0)
+		ms = headroom / rise * 250;
+	if (ms > headroom)
+		ms = headroom;
+	if (ms < TEMP_POLL_MIN_MS)
+		ms = TEMP_POLL_MIN_MS;
+	if (ms > TEMP_POLL_MAX_MS)
+		ms = TEMP_POLL_MAX_MS;
+	return ms;
+}
+
+static struct thermal th;
+
+static void temp_sample(struct cos_source *src)
+{
+	static int rise, last_headroom, reported = INT_MIN;
+	static long last_t;
+	struct thermal_zone *z;
+	struct timespec ts;
+	int i, worst, hottest, headroom;
+
+	if (src == &thermal_src)
+		uevent_wait(&thermal_ul, 0, 0);
+	else
+		timer_ack(src);
+
+	if ((worst = thermal_read(&th)) < 0) {
+		syslog(LOG_ERR, "unable to read any thermal zone\n");
+		timer_arm(&temp_timer_src, TEMP_POLL_MAX_MS);
+		return;
+	}
+	z = &th.zone[worst];
+	headroom = z->limit - z->temp;
+	/* leave the warning on screen, thermal_off_expired() checks
+	   again before powering off */
+	if (headroom <= 0 && !timer_armed(&thermal_off_src)) {
+		event_ring_post(ring, EVENT_TEMP_HIGH, z->temp);
+		syslog(LOG_NOTICE, "Temperature of %s is %d, shutdown system.\n",
+			z->type, z->temp);
+		timer_arm(&thermal_off_src, THERMAL_OFF_DELAY_MS);
+	}
+
+	hottest = z->temp;
+	for (i = 0; i < th.count; i++)
+		if (th.zone[i].temp > hottest)
+			hottest = th.zone[i].temp;
+	if (reported == INT_MIN ||
+	    abs(hottest - reported) >= TEMP_REPORT_STEP) {
+		syslog(LOG_DEBUG, "Current temperature: %d\n", hottest);
+		event_ring_post(ring, EVENT_TEMP, hottest);
+		reported = hottest;
+	}
+
+	/* rate at which the headroom shrinks, in mC per second */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (last_t && ts.tv_sec > last_t)
+		rise = (last_headroom - headroom) / (int)(ts.tv_sec - last_t);
+	last_t = ts.tv_sec;
+	last_headroom = headroom;
+	timer_arm(&temp_timer_src, temp_poll_ms(headroom, rise));
+}
+
+static void thermal_off_expired(struct cos_source *src)
+{
+	int worst;
+
+	timer_ack(src);
+	worst = thermal_read(&th);
+	if (worst >= 0 && th.zone[worst].temp < th.zone[worst].limit) {
+		syslog(LOG_NOTICE, "Temperature of %s is %d, shutdown cancelled.\n",
+			th.zone[worst].type, th.zone[worst].temp);
+		event_ring_post(ring, EVENT_TEMP_HIGH, 0);
+		return;
 	}
-	syslog(LOG_NOTICE, "RTC Alarm rang.Now reboot to MOS ...\n");
-	if (!is_power_low() && set_power_on_reason(1))
-		reboot(LINUX_REBOOT_CMD_RESTART);
+	reboot(LINUX_REBOOT_CMD_POWER_OFF);
+}
 
-err2:
-	close(rtc_fd);
-err1:
-	return NULL;
+static void temp_monitor_init(void)
+{
+	int i;
+
+	if (thermal_open(&th) < 0) {
+		syslog(LOG_ERR, "no thermal zone in %s\n", SYSFS_THERMAL);
+		return;
+	}
+	for (i = 0; i < th.count; i++)
+		syslog(LOG_DEBUG, "thermal zone %s, limit %d\n",
+			th.zone[i].type, th.zone[i].limit);
+	if (add_timer(&temp_timer_src, temp_sample) < 0 ||
+	    add_timer(&thermal_off_src, thermal_off_expired) < 0) {
+		syslog(LOG_ERR, "unable to create temperature timer\n");
+		return;
+	}
+	/* zones with trip points send a uevent when one is crossed */
+	if (uevent_open(&thermal_ul, "thermal") == 0)
+		add_source(&thermal_src, thermal_ul.fd, temp_sample);
+	temp_sample(&temp_timer_src);
 }
 
-void *temp_monitor_event(void *arg)
+/* the monotonic timers stand still while suspended, this alarm timer
+   wakes the SoC through the RTC for the periodic checks. the kernel
+   shares the RTC with the MOS alarm served by rtc_alarm(). */
+static void suspend_check(struct cos_source *src)
 {
-	int temp;
-	FILE *temp_fd;
+	timer_ack(src);
+	power_check();
+	temp_sample(&temp_timer_src);
+	if (suspended)
+		timer_arm(src, SUSPEND_CHECK_MS);
+}
 
-	temp_fd = fopen(SYS_TEMP_INT, "r");
-	if (temp_fd == NULL) {
-		syslog(LOG_ERR, "unable to open file %s\n", SYS_TEMP_INT);
-		return NULL;
+static void suspend_init(void)
+{
+	if (access(WAKE_LOCK, W_OK) < 0) {
+		syslog(LOG_INFO, "no wake locks, COS does not suspend\n");
+		return;
 	}
-	do {
-		fseek(temp_fd, 0, SEEK_SET);
-		fscanf(temp_fd, "%d\n", &temp);
-		syslog(LOG_DEBUG, "Current temperature: %d\n", temp);
-		if (temp > MAX_TEMP) {
-			msg.mtype = COS_TEMP_EVENT;
-			msgsnd(msgID, &msg, sizeof(struct msgtype), 0);
-			syslog(LOG_NOTICE, "Temperature is high, shutdown system.\n");
-			sleep(5);
-			reboot(LINUX_REBOOT_CMD_POWER_OFF);
-		}
-		sleep(30);
-	} while (1);
-	fclose(temp_fd);
-	return NULL;
+	if (add_clock_timer(&check_src, CLOCK_BOOTTIME_ALARM, suspend_check) < 0) {
+		syslog(LOG_INFO, "no alarm timers, COS does not suspend\n");
+		return;
+	}
+	wake_lock(1);
+	suspend_ok = 1;
 }
 
-int cos_event_main(int argc, char *argv[], int msgid)
+/* work that must be finished before the SoC may sleep */
+static int work_pending(void)
 {
-	pthread_t thr;
-	pthread_attr_t atr;
-	int err;
+	return boot_mos_flag || timer_armed(&power_timer_src) ||
+	       timer_armed(&power_off_src) || timer_armed(&longpress_src) ||
+	       timer_armed(&thermal_off_src);
+}
+
+static void suspend_enter(void)
+{
+	if (!suspend_ok || suspended || turn_off_screen() < 0)
+		return;
+	syslog(LOG_INFO, "display off, suspending between checks\n");
+	suspended = 1;
+	timer_arm(&check_src, SUSPEND_CHECK_MS);
+}
+
+static void suspend_leave(void)
+{
+	if (!suspended)
+		return;
+	wake_lock(1);
+	turn_on_screen();
+	suspended = 0;
+	timer_arm(&check_src, 0);
+}
 
-	msgID = msgid;
-	err = find_power_supply(&battery, "Battery");
-	err |= find_power_supply(&charger, "USB");
+static void log_wakeup(const struct wakeup_source *ws, void *data)
+{
+	char line[64];
+
+	wakeup_format(ws, line, sizeof(line));
+	syslog(LOG_INFO, "wakeup %s\n", line);
+}
+
+static void wakeup_dump(struct cos_source *src)
+{
+	timer_ack(src);
+	wakeup_each(log_wakeup, NULL);
+	timer_arm(src, WAKEUP_DUMP_MS);
+}
+
+int cos_event_main(int argc, char *argv[], struct event_ring *r)
+{
+	struct timespec start;
+	struct epoll_event evs[8];
+	struct cos_source *src;
+	int err, i, n;
+
+	ring = r;
+	err = power_supply_find(&battery, "Battery", POWER_SUPPLY_FIND_MS);
+	err |= power_supply_find(&charger, "USB", POWER_SUPPLY_FIND_MS);
 	if (err) {
 		syslog(LOG_ERR,
 			"There are issues with battery or charger driver. shutting down\n");
@@ -739,21 +938,41 @@ int cos_event_main(int argc, char *argv[], int msgid)
 		reboot(LINUX_REBOOT_CMD_POWER_OFF);
 	}
 
-	if (pthread_attr_init(&atr) != 0) {
-		syslog(LOG_ERR, "ERROR: Unable to set event thread attribute.\n");
-	} else {
-		if (pthread_create(&thr, &atr, powerbtn_event, NULL) != 0)
-			syslog(LOG_ERR,
-				"ERROR: Unable to create power_btn_press thread.\n");
-		if (pthread_create(&thr, &atr, power_monitor_event, NULL) != 0)
-			syslog(LOG_ERR,
-				"ERROR: Unable to create power_monitor thread.\n");
-		if (pthread_create(&thr, &atr, rtc_alarm_event, NULL) != 0)
-			syslog(LOG_ERR, "ERROR: Unable to create usbcharger thread.\n");
-		if (pthread_create(&thr, &atr, temp_monitor_event, NULL) != 0)
-			syslog(LOG_ERR, "ERROR: Unable to create temp monitor thread.\n");
-	}
-	while (1) {
-		sleep(100);
+	/* everything runs from this one loop, no threads and no signals */
+	if ((epoll_fd = epoll_create(MAX_DEVICES + 8)) < 0) {
+		syslog(LOG_ERR, "ERROR: Unable to create the event loop.\n");
+		return -1;
+	}
+	if (backlight_open() < 0)
+		syslog(LOG_ERR, "no backlight in %s\n", SYSFS_BACKLIGHT);
+	if (powerbtn_init() < 0)
+		syslog(LOG_ERR, "ERROR: Unable to monitor the power button.\n");
+	if (power_monitor_init() < 0)
+		syslog(LOG_ERR, "ERROR: Unable to monitor the power supply.\n");
+	rtc_alarm_init();
+	temp_monitor_init();
+	if (add_timer(&dump_src, wakeup_dump) == 0)
+		timer_arm(&dump_src, WAKEUP_DUMP_MS);
+	suspend_init();
+
+	for (;;) {
+		n = epoll_wait(epoll_fd, evs, sizeof(evs) / sizeof(evs[0]), -1);
+		if (n < 0 && errno != EINTR) {
+			syslog(LOG_ERR, "epoll_wait error: %s\n", strerror(errno));
+			return -1;
+		}
+		if (n > 0 && suspended)
+			wake_lock(1);
+		for (i = 0; i < n; i++) {
+			src = evs[i].data.ptr;
+			/* an earlier handler of this round may have dropped it */
+			if (src->fd < 0)
+				continue;
+			wakeup_begin(&src->ws, &start);
+			src->handle(src);
+			wakeup_end(&src->ws, &start);
+		}
+		if (suspended)
+			wake_lock(work_pending());
 	}
 }
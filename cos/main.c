@@ -38,24 +38,22 @@
 #include <unistd.h>
 #include <syslog.h>
 #include <sys/types.h>
-#include <sys/ipc.h>
-#include <sys/msg.h>
 #include <sys/stat.h>
 
-extern int cos_event_main(int argc, char *argv[], int msgid);
-extern int cos_ui(int argc, char *argv[], int fd, int msgid);
+#include "event_ring.h"
+
+extern int cos_event_main(int argc, char *argv[], struct event_ring *ring);
+extern int cos_ui(int argc, char *argv[], int fd, struct event_ring *ring);
 
 int cos_main(int argc, char *argv[])
 {
 	int fd[2];
 	pid_t pid;
-	key_t key;
-	int msgid;
+	struct event_ring *ring;
 
-	key = getpid();
-	msgid = msgget(key, S_IRUSR | S_IWUSR | IPC_CREAT | IPC_EXCL);
-	if (msgid == -1) {
-		syslog(LOG_ERR, "msg create error\n");
+	ring = event_ring_create();
+	if (ring == NULL) {
+		syslog(LOG_ERR, "event ring create error\n");
 		return -1;
 	}
 
@@ -65,9 +63,9 @@ int cos_main(int argc, char *argv[])
 	if ((pid = fork()) < 0) {
 		syslog(LOG_ERR, "fork error\n");
 	} else if (pid > 0) {
-		cos_event_main(argc, argv, msgid);
+		cos_event_main(argc, argv, ring);
 	} else {
-		cos_ui(argc, argv, fd[0], msgid);
+		cos_ui(argc, argv, fd[0], ring);
 	}
 
 	return 0;
@@ -56,16 +56,21 @@
 #include <sys/poll.h>
 #include <sys/ioctl.h>
 #include <sys/reboot.h>
-#include <sys/msg.h>
 
 #include <linux/fb.h>
 #include <linux/kd.h>
 #include <linux/reboot.h>
 
 #include "recovery.h"
+#include "event_ring.h"
+#include "wakeup.h"
 
 #define BATTERY_CAPACITY_FULL 100
 #define BATTERY_CAPACITY "/sys/class/power_supply"
+/* refreshes between two syslog dumps of the UI wakeup counters */
+#define WAKEUP_DUMP_REFRESHES 600
+/* one step of the charging animation */
+#define CHARGE_TICK_MS 1000
 
 static int main_window_width = 0;
 static int main_window_height = 0;
@@ -89,6 +94,7 @@ static coordinates progress;
 static int capacity = 0;
 static int charger_flag = 1;
 static int charging_full = 0;
+static int temperature = INT_MIN;	/* hottest zone in mC, INT_MIN until known */
 static char *labelText = "BKB Charging OS";
 static char *labelText_user_info = "Keep pressing power button 3s to Android";
 static LiteWindow *window = NULL;
@@ -105,11 +111,9 @@ static DFBColor red = { a: 255, r: 255, g: 0, b:0 };
 static DFBColor green = { a: 255, r: 0, g: 255, b:0 };
 static DFBColor black = { a: 0, r: 0, g: 0, b:0 };
 static DFBColor white = { a: 255, r: 255, g: 255, b:255 };
+static DFBColor *labelColor_user_info = &green;
 
-static struct msgtype {
-	long mtype;
-	char buffer[100];
-} msg;
+static struct event_ring *ring;
 
 static int init_ui()
 {
@@ -202,24 +206,31 @@ int open_tip_win(char *info)
 	return 0;
 }
 
-void user_info(char *buffer)
+void user_info(const struct event_rec *ev)
 {
 	char *info;
 
-	if (strcmp(buffer, COS_BOOT_MOS_BUF) == 0)
+	if (ev->type == EVENT_BOOT_MOS)
 		info = "    Release power button to enter into MOS     ";
-	else if (strcmp(buffer, COS_CHRG_REMOVE) == 0)
+	else if (ev->type == EVENT_CHARGER && !ev->value)
 		info = "   The phone will shut down after 5s";
-	else if (strcmp(buffer, COS_VOL_LOW) == 0)
+	else if (ev->type == EVENT_GATE && !ev->value)
 		info = "The battery low ,please insert charge";
-	else if (strcmp(buffer, COS_VOL_HIGH) == 0)
+	else if (ev->type == EVENT_GATE) {
 		lite_close_window(children_window);
-	else
+		return;
+	} else
 		info = "       Get error userinfo        ";
 
 	open_tip_win(info);
 }
 
+/* the label texts on screen, a label is only redrawn when its text
+   changes. event listener thread only. */
+static char time_shown[256];
+static char capacity_shown[256];
+static int bar_shown = -1;
+
 void get_now_time()
 {
 	time_t now;
@@ -231,7 +242,12 @@ void get_now_time()
 	sprintf(buf, " %04d-%02d-%02d  %02d:%02d",
 		(info->tm_year + 1900), (info->tm_mon + 1),
 		(info->tm_mday), (info->tm_hour), (info->tm_min));
-	lite_set_label_text(labelTime, buf);
+	if (temperature != INT_MIN)
+		sprintf(buf + strlen(buf), "  %dC", temperature / 1000);
+	if (strcmp(buf, time_shown)) {
+		strcpy(time_shown, buf);
+		lite_set_label_text(labelTime, buf);
+	}
 }
 
 void show_capacity()
@@ -243,21 +259,116 @@ void show_capacity()
 		 capacity), "%");
 	if (charging_full)
 		strcpy(buf, "FULL");
-	lite_set_label_text(labelBat, buf);
+	if (strcmp(buf, capacity_shown)) {
+		strcpy(capacity_shown, buf);
+		lite_set_label_text(labelBat, buf);
+	}
+}
+
+static void show_bar(int value)
+{
+	if (value != bar_shown) {
+		bar_shown = value;
+		lite_set_progressbar_value(progressbar, value / 100.0f);
+	}
+}
+
+static int screen_on(void)
+{
+	return event_ring_state(ring, EVENT_SCREEN) != 0;
+}
+
+/* whether the charging animation runs, it stops with the screen */
+static int charge_animating(void)
+{
+	return charger_flag && !charging_full && screen_on();
+}
+
+/* ms until the clock label shows another minute */
+static int next_minute_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return 60000 - (ts.tv_sec % 60) * 1000 - ts.tv_nsec / 1000000;
+}
+
+/* bring the labels and the bar up to date, tick steps the animation */
+static void refresh_status(int tick)
+{
+	static int cap = -1;
+
+	get_now_time();
+	show_capacity();
+	if (charging_full)
+		show_bar(100);
+	else if (charger_flag) {
+		if (tick)
+			cap += 20;
+		if (cap > 100 || cap % 20)
+			cap = capacity - capacity % 20;
+		show_bar(cap);
+	} else {
+		cap = capacity;
+		show_bar(cap);
+	}
+}
+
+static struct wakeup_source events_ws =
+	WAKEUP_SOURCE_INIT(WAKEUP_COS_UI_EVENTS, "ui_events");
+static struct wakeup_source refresh_ws =
+	WAKEUP_SOURCE_INIT(WAKEUP_COS_UI_REFRESH, "ui_refresh");
+
+static void log_wakeup(const struct wakeup_source *ws, void *data)
+{
+	char line[64];
+
+	wakeup_format(ws, line, sizeof(line));
+	syslog(LOG_INFO, "wakeup %s\n", line);
 }
 
 volatile int capacity_update = 0;
+/* applies the events to the screen as they come. with the screen on,
+   it also wakes up for the clock minute and, while charging, for the
+   animation; with the screen off it sleeps until the next event. */
 void *event_listener(void *data)
 {
-	int msgid = *(int *)data;
+	struct event_rec ev;
+	struct timespec start;
+	int timeout, tick, ret, refreshes = 0;
+
 	syslog(LOG_DEBUG, "event listener created ...\n");
-	while (1) {
-		msgrcv(msgid, &msg, sizeof(struct msgtype), 0, 0);
-		switch (msg.mtype) {
-		case COS_CHRG_EVENT:
-			if (strcmp(msg.buffer, COS_CHRG_REMOVE) == 0) {
+	for (;;) {
+		timeout = -1;
+		tick = 0;
+		if (capacity_update && screen_on()) {
+			timeout = next_minute_ms();
+			if (charge_animating() && timeout > CHARGE_TICK_MS) {
+				timeout = CHARGE_TICK_MS;
+				tick = 1;
+			}
+		}
+		ret = event_ring_timedwait(ring, &ev, timeout);
+		if (ret < 0)
+			break;
+		if (ret == 1) {
+			wakeup_begin(&refresh_ws, &start);
+			refresh_status(tick);
+			wakeup_end(&refresh_ws, &start);
+			if (++refreshes == WAKEUP_DUMP_REFRESHES) {
+				wakeup_each(log_wakeup, NULL);
+				refreshes = 0;
+			}
+			continue;
+		}
+
+		wakeup_begin(&events_ws, &start);
+		switch (ev.type) {
+		case EVENT_CHARGER:
+			if (!ev.value) {
 				labelText_user_info =
 				    "USB charger removal or abnormal status...";
+				labelColor_user_info = &red;
 				lite_set_label_color(labelTitle, &red);
 				lite_set_label_text(labelTitle,
 						    labelText_user_info);
@@ -265,46 +376,62 @@ void *event_listener(void *data)
 			} else {
 				labelText_user_info =
 				    "Keep pressing power button 3s to Android";
+				labelColor_user_info = &green;
 				lite_set_label_color(labelTitle, &green);
 				lite_set_label_text(labelTitle,
 						    labelText_user_info);
 				charger_flag = 1;
 			}
 			break;
-		case COS_VOL_GATE:
-			if (strcmp(msg.buffer, COS_VOL_LOW) == 0) {
+		case EVENT_GATE:
+			if (!ev.value) {
 				labelText_user_info =
 				    "Power is too LOW to enter Android";
+				labelColor_user_info = &red;
 				lite_set_label_color(labelTitle, &red);
 				lite_set_label_text(labelTitle,
 						    labelText_user_info);
 			} else {
 				labelText_user_info =
 				    "Keep pressing power button 3s to Android";
+				labelColor_user_info = &green;
 				lite_set_label_color(labelTitle, &green);
 				lite_set_label_text(labelTitle,
 						    labelText_user_info);
 			}
 			break;
-		case COS_TEMP_EVENT:
-			labelText_user_info =
-				    "Temperature is too high, shutdown system!";
+		case EVENT_TEMP_HIGH:
+			/* 0 once the shutdown is cancelled, the charger and
+			   gate message comes back */
+			if (ev.value) {
 				lite_set_label_color(labelTitle, &red);
+				lite_set_label_text(labelTitle,
+				    "Temperature is too high, shutdown system!");
+			} else {
+				lite_set_label_color(labelTitle,
+						     labelColor_user_info);
 				lite_set_label_text(labelTitle,
 						    labelText_user_info);
+			}
+			break;
+		case EVENT_TEMP:
+			temperature = ev.value;
+			break;
+		case EVENT_SCREEN:
+			/* the clock and the animation resume from here */
 			break;
-		case COS_BOOT_MOS:
-			user_info(msg.buffer);
+		case EVENT_BOOT_MOS:
+			user_info(&ev);
 			break;
-		case COS_BAT_STATUS:
+		case EVENT_BATTERY:
 			capacity_update = 1;
-			if (strcmp(msg.buffer, "FULL")) {
+			if (ev.value != EVENT_BATTERY_FULL) {
 				if (charging_full) {
 					syslog(LOG_ERR, "This should never happen,"
 							"back to charging mode from maintenance mode\n");
 					charging_full = 0;
 				}
-				capacity = atoi(msg.buffer);
+				capacity = ev.value;
 			} else
 				charging_full = 1;
 /*			labelText_user_info =
@@ -313,40 +440,26 @@ void *event_listener(void *data)
 			lite_set_label_text(labelTitle, labelText_user_info);*/
 			break;
 		default:
-			syslog(LOG_WARNING, "Unknown msg type!\n");
-		}
-	}
-}
-
-void *battery_status_update(void *data)
-{
-	int cap = capacity;
-	while (1) {
-		get_now_time();
-		show_capacity();
-		if (charging_full)
-			lite_set_progressbar_value(progressbar, 100 / 100.0f);
-		else if (charger_flag) {
-			if (cap > 100 || cap % 20)
-				cap = capacity - capacity % 20;
-			lite_set_progressbar_value(progressbar, cap / 100.0f);
-			cap += 20;
-		} else {
-			cap = capacity;
-			lite_set_progressbar_value(progressbar, cap / 100.0f);
+			syslog(LOG_WARNING, "Unknown event type %d!\n", ev.type);
 		}
-		sleep(1);
+		/* nobody sees a redraw with the screen off, catch up when it
+		   comes back */
+		if (capacity_update && screen_on())
+			refresh_status(0);
+		wakeup_end(&events_ws, &start);
 	}
+	syslog(LOG_ERR, "event ring wait failed\n");
 	return NULL;
 }
 
-int cos_ui(int argc, char *argv[], int fd, int msgid)
+int cos_ui(int argc, char *argv[], int fd, struct event_ring *r)
 {
 	DFBRectangle rect;
 	DFBResult res;
 	LiteFont *font;
 	IDirectFBFont *font_interface;
 
+	ring = r;
 	/* initialize ui size */
 	if (init_ui() < 0)
 		return 1;
@@ -454,11 +567,9 @@ int cos_ui(int argc, char *argv[], int fd, int msgid)
 		pthread_attr_t attr_bat;
 
 		pthread_attr_init(&attr_bat);
-		pthread_create(&thread_bat, &attr_bat, event_listener, &msgid);
+		pthread_create(&thread_bat, &attr_bat, event_listener, NULL);
 		while (capacity_update == 0)
 			usleep(50000);
-		pthread_create(&thread_bat, &attr_bat, battery_status_update,
-			       (void *)imageBat);
 	}
 
 	/* show the window */
@@ -0,0 +1,193 @@
+/*************************************************************************
+ * Copyright(c) 2012 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * **************************************************************************/
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#include "event_ring.h"
+
+#define EVENT_RING_SIZE		64	/* power of two */
+
+struct event_ring {
+	/* written by the producer only */
+	volatile pid_t producer;
+	volatile unsigned head;
+	volatile int state[EVENT_TYPE_COUNT];
+	/* types to hand out with their latest value: dropped records
+	   and event_ring_notify() */
+	volatile unsigned lost;
+	/* written by the consumer only */
+	volatile unsigned tail;
+	volatile int waiting;
+	unsigned resync;		/* lost types still to hand out */
+
+	int efd;
+	struct event_rec rec[EVENT_RING_SIZE];
+};
+
+/* producers are threads of the one producer process, the lock is not
+   shared */
+static pthread_mutex_t post_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct event_ring *event_ring_create(void)
+{
+	struct event_ring *r;
+	int i;
+
+	r = mmap(NULL, sizeof(*r), PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (r == MAP_FAILED)
+		return NULL;
+	memset(r, 0, sizeof(*r));
+	for (i = 0; i < EVENT_TYPE_COUNT; i++)
+		r->state[i] = EVENT_STATE_UNKNOWN;
+	if ((r->efd = eventfd(0, 0)) < 0) {
+		munmap(r, sizeof(*r));
+		return NULL;
+	}
+	return r;
+}
+
+static void wake(struct event_ring *r)
+{
+	uint64_t one = 1;
+
+	/* pairs with the barrier in event_ring_wait(): either the consumer
+	   sees the new head, or we see it waiting */
+	__sync_synchronize();
+	if (r->waiting)
+		write(r->efd, &one, sizeof(one));
+}
+
+int event_ring_post(struct event_ring *r, int type, int value)
+{
+	unsigned head;
+
+	pid_t pid = getpid();
+
+	if (type < 0 || type >= EVENT_TYPE_COUNT) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (r->producer != pid &&
+	    !__sync_bool_compare_and_swap(&r->producer, 0, pid)) {
+		errno = EPERM;
+		return -1;
+	}
+	pthread_mutex_lock(&post_lock);
+	if (type < EVENT_STATE_COUNT && r->state[type] == value) {
+		pthread_mutex_unlock(&post_lock);
+		return 0;
+	}
+	r->state[type] = value;
+	head = r->head;
+	if (head - r->tail >= EVENT_RING_SIZE) {
+		__sync_fetch_and_or(&r->lost, 1 << type);
+	} else {
+		r->rec[head & (EVENT_RING_SIZE - 1)].type = type;
+		r->rec[head & (EVENT_RING_SIZE - 1)].value = value;
+		/* the record must be visible before the new head */
+		__sync_synchronize();
+		r->head = head + 1;
+	}
+	wake(r);
+	pthread_mutex_unlock(&post_lock);
+	return 0;
+}
+
+/* no lock: a signal may interrupt event_ring_post() in this thread */
+void event_ring_notify(struct event_ring *r, int type, int value)
+{
+	if (type < 0 || type >= EVENT_STATE_COUNT)
+		return;
+	r->state[type] = value;
+	__sync_fetch_and_or(&r->lost, 1 << type);
+	wake(r);
+}
+
+int event_ring_state(struct event_ring *r, int type)
+{
+	if (type < 0 || type >= EVENT_TYPE_COUNT)
+		return EVENT_STATE_UNKNOWN;
+	return r->state[type];
+}
+
+/* take one record, or one lost type, if there is any */
+static int take(struct event_ring *r, struct event_rec *ev)
+{
+	unsigned tail = r->tail;
+	int type;
+
+	if (tail != r->head) {
+		__sync_synchronize();
+		*ev = r->rec[tail & (EVENT_RING_SIZE - 1)];
+		__sync_synchronize();
+		r->tail = tail + 1;
+		return 1;
+	}
+	/* the queue is drained, replace what was dropped by the latest values */
+	if (r->resync == 0 && r->lost)
+		r->resync = __sync_fetch_and_and(&r->lost, 0);
+	if (r->resync) {
+		type = __builtin_ctz(r->resync);
+		r->resync &= ~(1 << type);
+		ev->type = type;
+		ev->value = r->state[type];
+		return 1;
+	}
+	return 0;
+}
+
+int event_ring_wait(struct event_ring *r, struct event_rec *ev)
+{
+	return event_ring_timedwait(r, ev, -1);
+}
+
+int event_ring_timedwait(struct event_ring *r, struct event_rec *ev,
+			 int timeout_ms)
+{
+	struct pollfd pfd;
+	uint64_t count;
+	int n;
+
+	pfd.fd = r->efd;
+	pfd.events = POLLIN;
+	for (;;) {
+		if (take(r, ev))
+			return 0;
+		r->waiting = 1;
+		__sync_synchronize();
+		if (take(r, ev)) {
+			r->waiting = 0;
+			return 0;
+		}
+		/* a signal restarts the full timeout, close enough here */
+		n = poll(&pfd, 1, timeout_ms);
+		if (n > 0 && read(r->efd, &count, sizeof(count)) < 0 &&
+		    errno != EINTR && errno != EAGAIN)
+			n = -1;
+		r->waiting = 0;
+		if (n == 0)
+			return take(r, ev) ? 0 : 1;
+		if (n < 0 && errno != EINTR)
+			return -1;
+	}
+}
@@ -0,0 +1,81 @@
+/*************************************************************************
+ * Copyright(c) 2012 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * **************************************************************************/
+#ifndef EVENT_RING_H
+#define EVENT_RING_H
+
+#include <limits.h>
+
+/*
+ * Events from the COS/POS event process to its UI process. Both sides
+ * map the same ring, created before the fork: records are written by
+ * the event process and read by the UI, with an eventfd to wake the UI
+ * up only when it is actually sleeping. The latest value of every type
+ * is also kept in a slot, so the UI can read the current state at any
+ * time without going through the queue.
+ */
+
+enum {
+	/* state: posting the value already in the slot is a no-op */
+	EVENT_CHARGER,		/* 1 plugged, 0 removed */
+	EVENT_GATE,		/* 1 above the voltage gate, 0 below */
+	EVENT_BATTERY,		/* capacity in %, or EVENT_BATTERY_FULL */
+	EVENT_TEMP,		/* hottest thermal zone, in mC */
+	EVENT_SCREEN,		/* 1 display on, 0 off */
+	EVENT_STATE_COUNT,
+	/* one-shot notifications */
+	EVENT_TEMP_HIGH = EVENT_STATE_COUNT,	/* shutting down in mC, 0 cancelled */
+	EVENT_BOOT_MOS,		/* release the power button to boot */
+	EVENT_TYPE_COUNT,
+};
+
+#define EVENT_BATTERY_FULL	1000
+/* slot value until the first event of the type */
+#define EVENT_STATE_UNKNOWN	INT_MIN
+
+struct event_rec {
+	int type;
+	int value;
+};
+
+struct event_ring;
+
+/* map a new ring, shared with the children forked afterwards.
+   returns NULL on error. */
+struct event_ring *event_ring_create(void);
+
+/* producer side. a single process posts, the first one to do so:
+   posting from another process fails with EPERM. its threads may all
+   post, they are serialized by a lock private to that process. when
+   the ring is full the record is dropped and the consumer later gets
+   the latest value of its type instead. */
+int event_ring_post(struct event_ring *r, int type, int value);
+
+/* async-signal-safe post of a state type: update the slot and wake the
+   consumer, which gets the latest value after the queued records */
+void event_ring_notify(struct event_ring *r, int type, int value);
+
+/* consumer side: block until there is a record and return it in ev.
+   returns 0, or -1 if the eventfd fails. */
+int event_ring_wait(struct event_ring *r, struct event_rec *ev);
+
+/* event_ring_wait() giving up after timeout_ms, -1 to wait forever.
+   returns 0 with a record in ev, 1 on timeout, -1 on error. */
+int event_ring_timedwait(struct event_ring *r, struct event_rec *ev,
+			 int timeout_ms);
+
+/* latest value of a type, EVENT_STATE_UNKNOWN if never posted */
+int event_ring_state(struct event_ring *r, int type);
+
+#endif
@@ -15,7 +15,14 @@ LOCAL_SRC_FILES := \
     modem.c \
     power.c \
     system_recovery.c \
-    ../updater/ifwi_update.c
+    ../updater/ifwi_update.c \
+    ../spawn.c \
+    ../power_supply.c \
+    ../uevent.c \
+    ../scu_ipc.c \
+    ../telemetry.c \
+    ../wakeup.c \
+    ../backlight.c
 
 LOCAL_MODULE := fastboot
 
@@ -138,6 +138,11 @@ int ui_block_visible(int type);
 void ui_start_process_bar();
 void ui_stop_process_bar();
 void ui_show_process(int show);
+/* show done of total bytes as a filled bar with the percentage and an
+   ETA, instead of the animation, until ui_reset_progress() */
+void ui_reset_progress(void);
+void ui_set_progress(unsigned long long done, unsigned long long total,
+		     const char *phase);
 void ui_print(const char *fmt, ...);
 void ui_msg(int type, int align, const char *fmt, ...);
 void ui_start_menu(char** items, int initial_selection);
@@ -145,6 +150,11 @@ int ui_menu_select(int sel);
 int ui_wait_key();
 int ui_key_pressed(int key);
 void ui_clear_key_queue();
+/* menu key input-to-photon latency: show the histogram summary on
+   screen and log every key (debug), and format it, one line per call
+   of fn */
+void ui_latency_overlay(int on);
+void ui_latency_each(void (*fn)(const char *line, void *data), void *data);
 void ui_init();
 void ui_exit();
 
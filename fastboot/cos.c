@@ -16,36 +16,88 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <linux/input.h>
 #include <sys/reboot.h>
 
 #include "minui.h"
 #include "common.h"
 #include "power.h"
+#include "../telemetry.h"
+#include "../uevent.h"
+#include "../wakeup.h"
 
 #define REBOOTTIMER_DELAY 2000
 
+/* POS leaves charging this far above the gate, so the voltage drop once
+   the charger load goes away does not put it back under the gate */
+#define GATE_HYSTERESIS_UV	50000
+#define GATE_SAMPLES		16
+/* not every fuel gauge sends a uevent when only the voltage moves */
+#define GATE_POLL_MS		10000
+#define GATE_MIN_WAIT_MS	1000
+/* the power monitor sleeps on power_supply uevents. the idle timeout
+   covers gauges that stay quiet; without uevents it polls every
+   POWER_LOSS_MS. the shutdown follows POWER_LOSS_GRACE_MS after the
+   charger went away, however many uevents came in between. */
+#define POWER_IDLE_MS		60000
+#define POWER_LOSS_MS		1000
+#define POWER_LOSS_GRACE_MS	5000
+/* between two wakeup counter records in the telemetry log */
+#define WAKEUP_LOG_MS		60000
+
+struct gate_sample {
+	long t_ms;
+	int voltage;
+	int current;
+	int charging;		/* charger present */
+};
+
+struct gate_estimator {
+	struct gate_sample s[GATE_SAMPLES];
+	int head;
+	int count;
+};
+
+/* a ui timer callback with its wakeup accounting */
+struct counted_timer {
+	struct wakeup_source ws;
+	int (*fn)(void *data);
+};
+
 //COS or POS mode
 static int charge_mode;
-static int voltage_gate;
-static int voltage_good_pipe[2];
 
-static struct power_supply_status charger;
-static struct power_supply_status battery;
+/* charger and battery are shared by the UI timer thread, the power
+   monitor and the gate wait, under supply_lock */
+static pthread_mutex_t supply_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct power_supply charger;
+static struct power_supply battery;
+static int power_monitor_gen;	/* a monitor of another generation quits */
 
 static ui_timer_t *battery_update_timer;
-static ui_timer_t *power_poll_timer;
 static ui_timer_t *reboot_timer;
 static int battery_update_icon = BACKGROUND_ICON_BAT100;
 
-static int battery_status_update_timer(void *data)
+// Should only be called with supply_lock held.
+static void battery_status_update_locked(void)
 {
-	static int current_icon;
+	static int current_icon = BACKGROUND_ICON_NONE;
+	static int current_capacity = -1;
 
 	if (battery_update_icon > BACKGROUND_ICON_BAT100) {
-		get_power_supply_status(&battery);
-		get_power_supply_status(&charger);
-		switch (battery.capacity) {
+		power_supply_read(&charger);
+		power_supply_read(&battery);
+		/* the icon only moves with the capacity. the power monitor
+		   reads the same handle, its change mask is not ours. */
+		if (battery.st.capacity == current_capacity &&
+		    current_icon != BACKGROUND_ICON_NONE) {
+			battery_update_icon = current_icon;
+			goto show;
+		}
+		switch (battery.st.capacity) {
 		case 0 ... 12:
 			battery_update_icon = BACKGROUND_ICON_BAT00;
 			break;
@@ -78,52 +130,84 @@ static int battery_status_update_timer(void *data)
 			break;
 		}
 		current_icon = battery_update_icon;
+		current_capacity = battery.st.capacity;
 	}
-	if (battery.status == CHARGE_STATUS_CHARGING)
+show:
+	if (battery.st.status == POWER_SUPPLY_STATUS_CHARGING)
 		ui_set_background(battery_update_icon);
-	else if (battery.status == CHARGE_STATUS_FULL)
+	else if (battery.st.status == POWER_SUPPLY_STATUS_FULL)
 		ui_set_background(BACKGROUND_ICON_FULL);
-	else if (charger.present)
+	else if (charger.st.present)
 		ui_set_background(BACKGROUND_ICON_ERR);
 	else
 		ui_set_background(current_icon);
 
 	battery_update_icon++;
+}
+
+static long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static int battery_status_update_timer(void *data)
+{
+	pthread_mutex_lock(&supply_lock);
+	battery_status_update_locked();
+	pthread_mutex_unlock(&supply_lock);
 	return TIMER_AGAIN;
 }
 
-static int power_poll_timer_cb(void *data)
+/* returns the ms left before the shutdown while the charger is away,
+   0 otherwise. Should only be called with supply_lock held. */
+static long power_check_locked(void)
 {
-	static int power_loss_counter = 0;
-	char status_buf[256];
+	static struct power_supply_status logged;
+	static int logged_charger = -1;
+	static long power_loss_since;
+	static int full_shown;
+	long left = 0;
 
-	get_power_supply_status(&charger);
-	get_power_supply_status(&battery);
+	/* the handles are shared, their change masks belong to whoever
+	   read last: compare with what this function saw itself */
+	power_supply_read(&charger);
+	power_supply_read(&battery);
+	if (charger.st.present != logged_charger ||
+	    memcmp(&battery.st, &logged, sizeof(logged))) {
+		telemetry_add(&battery.st, charger.st.present);
+		logged = battery.st;
+		logged_charger = charger.st.present;
+	}
 
-	if (!charger.present) {
-		if (power_loss_counter == 0) {
+	if (!charger.st.present) {
+		if (power_loss_since == 0) {
+			power_loss_since = now_ms();
 			ui_set_screen_state(1);
 			ui_msg(ALERT, MIDDLE, "CHARGER REMOVE");
 		}
-		if (power_loss_counter++ > 4) {
+		left = power_loss_since + POWER_LOSS_GRACE_MS - now_ms();
+		if (left <= 0) {
 			LOGI("[SHTDWN] %s, shutdown due to power loss", __func__);
 			force_shutdown();
+			left = POWER_LOSS_MS;
 		}
-	} else if(power_loss_counter != 0) {
+	} else if (power_loss_since != 0) {
 		ui_msg(TIPS, MIDDLE, " ");
-		power_loss_counter = 0;
+		power_loss_since = 0;
 	}
 
-	if (battery.status == CHARGE_STATUS_FULL && power_loss_counter == 0) {
+	if (battery.st.status != POWER_SUPPLY_STATUS_FULL)
+		full_shown = 0;
+	else if (!full_shown && power_loss_since == 0) {
 		ui_set_screen_state(1);
 		ui_msg(TIPS, MIDDLE, "BATTERY CHARGE FULL");
+		full_shown = 1;
 	}
 
-	if (charge_mode == MODE_POS && battery.voltage_now > voltage_gate) {
-		write(voltage_good_pipe[1],"OK",2);
-	}
-
-	return TIMER_AGAIN;
+	return left;
 }
 
 static int reboot_timer_cb(void *data)
@@ -133,34 +217,219 @@ static int reboot_timer_cb(void *data)
 	return TIMER_STOP;
 }
 
-static int charge_in_pos()
+static struct counted_timer battery_update_counted = {
+	WAKEUP_SOURCE_INIT(WAKEUP_FB_BATTERY_TIMER, "battery_update_timer"),
+	battery_status_update_timer,
+};
+static struct counted_timer reboot_counted = {
+	WAKEUP_SOURCE_INIT(WAKEUP_FB_REBOOT_TIMER, "reboot_timer"),
+	reboot_timer_cb,
+};
+static struct wakeup_source power_monitor_ws =
+	WAKEUP_SOURCE_INIT(WAKEUP_FB_POWER_POLL, "power_monitor");
+static struct wakeup_source gate_wait_ws =
+	WAKEUP_SOURCE_INIT(WAKEUP_FB_GATE_WAIT, "gate_wait");
+
+static void log_wakeup(const struct wakeup_source *ws, void *data)
+{
+	telemetry_add_counter(ws->id, ws->count, ws->cpu_ns);
+}
+
+static int counted_timer_cb(void *data)
+{
+	struct counted_timer *t = data;
+	struct timespec start;
+	int ret;
+
+	wakeup_begin(&t->ws, &start);
+	ret = t->fn(NULL);
+	wakeup_end(&t->ws, &start);
+	return ret;
+}
+
+/* follows the charger and the battery from their uevents instead of a
+   1 s poll, until charge_in_pos() stops it */
+static void *power_monitor_thread(void *data)
 {
-	int ret = -1;
-	char buf[2];
+	int gen = (int)(intptr_t)data;
+	struct uevent_listener ul;
+	struct timespec start;
+	long last_log = now_ms();
+	int listening;
+	long left, timeout;
+
+	listening = uevent_open(&ul, "power_supply") == 0;
+	if (!listening)
+		LOGW("no power_supply uevents, polling every %d ms\n", POWER_LOSS_MS);
 
-	voltage_gate = get_voltage_gate();
-	if (pipe(voltage_good_pipe) != 0) {
-		LOGE("pipe error!\n");
-		goto err;
+	for (;;) {
+		pthread_mutex_lock(&supply_lock);
+		if (gen != power_monitor_gen) {
+			pthread_mutex_unlock(&supply_lock);
+			break;
+		}
+		wakeup_begin(&power_monitor_ws, &start);
+		left = power_check_locked();
+		wakeup_end(&power_monitor_ws, &start);
+		pthread_mutex_unlock(&supply_lock);
+
+		if (now_ms() - last_log >= WAKEUP_LOG_MS) {
+			wakeup_each(log_wakeup, NULL);
+			last_log = now_ms();
+		}
+
+		/* no uevent may come before the shutdown is due */
+		timeout = listening ? POWER_IDLE_MS : POWER_LOSS_MS;
+		if (left && left < timeout)
+			timeout = left;
+		if (!listening || uevent_wait(&ul, timeout, UEVENT_DEBOUNCE_MS) < 0)
+			usleep(timeout * 1000);
 	}
-	do {
-		read(voltage_good_pipe[0], buf, 2);
-	} while (strncmp(buf, "OK", 2));
-	ret = 0;
-err:
+	if (listening)
+		uevent_close(&ul);
+	return NULL;
+}
+
+static void gate_add(struct gate_estimator *e, long t_ms, int voltage,
+		     int current, int charging)
+{
+	struct gate_sample *last;
+
+	if (e->count) {
+		last = &e->s[(e->head + GATE_SAMPLES - 1) % GATE_SAMPLES];
+		/* the charger came or went, or the battery turned from
+		   charging to discharging: the old slope is meaningless.
+		   gauge noise on the current alone does not restart it. */
+		if (charging != last->charging ||
+		    (current < 0) != (last->current < 0))
+			e->count = 0;
+	}
+	e->s[e->head].t_ms = t_ms;
+	e->s[e->head].voltage = voltage;
+	e->s[e->head].current = current;
+	e->s[e->head].charging = charging;
+	e->head = (e->head + 1) % GATE_SAMPLES;
+	if (e->count < GATE_SAMPLES)
+		e->count++;
+}
+
+/* least squares fit of the voltage over the window. returns the time
+   until target is reached in ms, or -1 if the voltage is not rising */
+static long gate_eta_ms(const struct gate_estimator *e, int target)
+{
+	long long st = 0, sv = 0, stt = 0, stv = 0, num, den;
+	const struct gate_sample *p;
+	long t0, t;
+	int i, n = e->count;
+
+	if (n < 2)
+		return -1;
+	t0 = e->s[(e->head + GATE_SAMPLES - n) % GATE_SAMPLES].t_ms;
+	for (i = 0; i < n; i++) {
+		p = &e->s[(e->head + GATE_SAMPLES - n + i) % GATE_SAMPLES];
+		t = p->t_ms - t0;
+		st += t;
+		sv += p->voltage;
+		stt += (long long)t * t;
+		stv += (long long)t * p->voltage;
+	}
+	/* slope = num / den in uV per ms */
+	num = n * stv - st * sv;
+	den = n * stt - st * st;
+	if (num <= 0 || den <= 0)
+		return -1;
+	p = &e->s[(e->head + GATE_SAMPLES - 1) % GATE_SAMPLES];
+	return (long)((target - p->voltage) * den / num);
+}
+
+/* wait until the battery is past the gate, woken up by the fuel gauge
+   uevents and by the predicted crossing time, whichever comes first */
+static int wait_voltage_gate(int target)
+{
+	struct gate_estimator est;
+	struct uevent_listener ul;
+	struct power_supply gauge;
+	int listening, shown = -2, minutes, present;
+	long eta, timeout;
+	struct timespec start;
+
+	memset(&est, 0, sizeof(est));
+	/* a handle of our own, the timers use battery on the UI thread */
+	if (power_supply_find(&gauge, "Battery", POWER_SUPPLY_FIND_MS)) {
+		LOGE("did not find power_supply Battery\n");
+		return -1;
+	}
+	listening = uevent_open(&ul, "power_supply") == 0;
+	if (!listening)
+		LOGW("no power_supply uevents, polling every %d ms\n", GATE_POLL_MS);
+
+	for (;;) {
+		wakeup_begin(&gate_wait_ws, &start);
+		if (power_supply_read(&gauge) < 0)
+			LOGE("unable to read %s\n", gauge.path);
+		if (gauge.st.voltage_now >= target) {
+			wakeup_end(&gate_wait_ws, &start);
+			break;
+		}
+
+		/* the power monitor refreshes charger */
+		pthread_mutex_lock(&supply_lock);
+		present = charger.st.present;
+		pthread_mutex_unlock(&supply_lock);
+
+		gate_add(&est, now_ms(), gauge.st.voltage_now,
+			 gauge.st.current_now, present);
+		eta = gate_eta_ms(&est, target);
+		minutes = eta < 0 ? -1 : (int)((eta + 59999) / 60000);
+		if (!present)
+			shown = -2;	/* the timer owns the message line */
+		else if (minutes != shown) {
+			if (minutes < 0)
+				ui_msg(TIPS, MIDDLE, "CHARGING TO %d mV", target / 1000);
+			else
+				ui_msg(TIPS, MIDDLE, "CHARGING, ABOUT %d MIN LEFT", minutes);
+			shown = minutes;
+		}
+
+		timeout = GATE_POLL_MS;
+		if (eta >= 0 && eta < timeout)
+			timeout = eta < GATE_MIN_WAIT_MS ? GATE_MIN_WAIT_MS : eta;
+		wakeup_end(&gate_wait_ws, &start);
+		if (!listening || uevent_wait(&ul, timeout, UEVENT_DEBOUNCE_MS) < 0)
+			usleep(timeout * 1000);
+	}
+
+	LOGI("battery at %d uV, gate %d uV\n", gauge.st.voltage_now, target);
+	if (shown != -2)
+		ui_msg(TIPS, MIDDLE, " ");
+	if (listening)
+		uevent_close(&ul);
+	power_supply_close(&gauge);
+	return 0;
+}
+
+static int charge_in_pos()
+{
+	int ret;
+
+	ret = wait_voltage_gate(get_voltage_gate() + GATE_HYSTERESIS_UV);
+
 	ui_stop_timer(battery_update_timer);
-	ui_stop_timer(power_poll_timer);
+	pthread_mutex_lock(&supply_lock);
+	power_monitor_gen++;
+	pthread_mutex_unlock(&supply_lock);
 	ui_restore_screensaver_delay();
 	return ret;
 }
 
 int cos_main(int mode)
 {
-	int ret;
+	pthread_t monitor;
+	int ret, gen;
 
 	charge_mode = mode;
-	ret = find_power_supply(&battery, "Battery");
-	ret |= find_power_supply(&charger, "USB");
+	ret = power_supply_find(&battery, "Battery", POWER_SUPPLY_FIND_MS);
+	ret |= power_supply_find(&charger, "USB", POWER_SUPPLY_FIND_MS);
 	if (ret != 0) {
 		ui_set_background(BACKGROUND_ICON_ERR);
 		ui_msg(ALERT, LEFT, "Bad charger! Force shutdown...");
@@ -168,17 +437,23 @@ int cos_main(int mode)
 		force_shutdown();
 	}
 	ui_set_screensaver_delay(15000);
-	battery_update_timer = ui_alloc_timer(battery_status_update_timer, 1, NULL);
+	battery_update_timer = ui_alloc_timer(counted_timer_cb, 1, &battery_update_counted);
 	ui_start_timer(battery_update_timer,1000);
-	power_poll_timer = ui_alloc_timer(power_poll_timer_cb, 0, NULL);
-	ui_start_timer(power_poll_timer,1000);
+	pthread_mutex_lock(&supply_lock);
+	gen = power_monitor_gen;
+	pthread_mutex_unlock(&supply_lock);
+	if (pthread_create(&monitor, NULL, power_monitor_thread,
+			   (void *)(intptr_t)gen) == 0)
+		pthread_detach(monitor);
+	else
+		LOGE("unable to start the power monitor\n");
 
 	if (mode == MODE_POS)
 		return charge_in_pos();
 
 	//charge in COS mode
 	modem_airplane();
-	reboot_timer = ui_alloc_timer(reboot_timer_cb, 0, NULL);
+	reboot_timer = ui_alloc_timer(counted_timer_cb, 0, &reboot_counted);
 	for (;;) {
 		int key = ui_wait_key();
 		ui_set_screen_state(1);
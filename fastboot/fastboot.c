@@ -36,6 +36,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <cutils/properties.h>
 #include "common.h"
 
@@ -138,6 +139,10 @@ static unsigned download_size;
 #define STATE_COMPLETE	2
 #define STATE_ERROR	3
 
+/* downloads big enough for a progress bar, reported every so many reads */
+#define PROGRESS_MIN_BYTES	(1024 * 1024)
+#define PROGRESS_CHUNKS		64
+
 static unsigned fastboot_state = STATE_OFFLINE;
 int fb_fp = -1;
 int enable_fp;
@@ -149,7 +154,7 @@ static int usb_read(void *_buf, unsigned len)
 	unsigned char *buf = _buf;
 	int count = 0;
 	int tot_len = len;
-	int progress_update=0;
+	int progress_update = 0;
 	if (fastboot_state == STATE_ERROR)
 		goto oops;
 
@@ -161,14 +166,15 @@ static int usb_read(void *_buf, unsigned len)
 			LOGW("Warning:usb read failed\n");
 			goto oops;
 		}
-		if (progress_update++ > 500) {
-			progress_update = 0;
-		}
-
 		count += r;
 		buf +=r;
 		len -= r;
 
+		/* the UI only redraws when the percentage moves */
+		if (tot_len >= PROGRESS_MIN_BYTES &&
+		    (++progress_update % PROGRESS_CHUNKS == 0 || len == 0))
+			ui_set_progress(count, tot_len, "DOWNLOAD");
+
 		/* short transfer? */
 		if (r != (int)xfer) break;
 	}
@@ -219,25 +225,138 @@ void fastboot_ack(const char *code, const char *reason)
 
 }
 
-#define TEMP_BUFFER_SIZE		512
+void fastboot_info(const char *info)
+{
+	char response[65];
+
+	if (fastboot_state != STATE_COMMAND)
+		return;
+
+	snprintf(response, 65, "%s%s", "INFO", info);
+
+	usb_write(response, strlen(response));
+}
+
 #define RESULT_FAIL_STRING		"RESULT: FAIL("
-void fastboot_fail(const char *reason)
+
+/* the command loop's own UI updates, run by ui_note_thread so the host
+   does not wait for them. a note is one command and its result, so the
+   two are shown or dropped together. */
+enum {
+	NOTE_NONE,
+	NOTE_OKAY,
+	NOTE_FAIL,
+};
+
+#define NOTE_QUEUE	16
+
+struct ui_note {
+	char cmd[64];		/* empty once shown, or for a bare result */
+	int result;		/* NOTE_NONE while the command runs */
+	char reason[64];
+};
+
+static struct ui_note note_queue[NOTE_QUEUE];
+static unsigned note_head, note_tail;
+static pthread_mutex_t note_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t note_cond = PTHREAD_COND_INITIALIZER;
+
+static struct ui_note *note_at(unsigned i)
+{
+	return &note_queue[i % NOTE_QUEUE];
+}
+
+/* callers hold note_mutex */
+static struct ui_note *note_add_locked(void)
+{
+	struct ui_note *n;
+
+	/* a UI that falls behind loses its oldest commands. a bare result
+	   ends a command already on screen, that one is kept. */
+	if (note_tail - note_head == NOTE_QUEUE) {
+		if (!note_at(note_head)->cmd[0])
+			*note_at(note_head + 1) = *note_at(note_head);
+		note_head++;
+	}
+	n = note_at(note_tail++);
+	n->cmd[0] = '\0';
+	n->result = NOTE_NONE;
+	n->reason[0] = '\0';
+	return n;
+}
+
+static void ui_note_cmd(const char *cmd)
 {
-	char buf[TEMP_BUFFER_SIZE];
+	struct ui_note *n;
+
+	pthread_mutex_lock(&note_mutex);
+	n = note_add_locked();
+	strncpy(n->cmd, cmd, sizeof(n->cmd) - 1);
+	n->cmd[sizeof(n->cmd) - 1] = '\0';
+	pthread_cond_signal(&note_cond);
+	pthread_mutex_unlock(&note_mutex);
+}
 
-	sprintf(buf, RESULT_FAIL_STRING);
-	strncat(buf, reason, TEMP_BUFFER_SIZE - 2 - strlen(RESULT_FAIL_STRING));
-	strcat(buf, ")");
-	ui_msg(ALERT, LEFT, buf);
-	ui_stop_process_bar();
+static void ui_note_result(int result, const char *reason)
+{
+	struct ui_note *n = NULL;
+
+	pthread_mutex_lock(&note_mutex);
+	/* complete the command if it is still queued */
+	if (note_tail != note_head) {
+		n = note_at(note_tail - 1);
+		if (!n->cmd[0] || n->result != NOTE_NONE)
+			n = NULL;
+	}
+	if (!n)
+		n = note_add_locked();
+	n->result = result;
+	strncpy(n->reason, reason ? reason : "", sizeof(n->reason) - 1);
+	n->reason[sizeof(n->reason) - 1] = '\0';
+	pthread_cond_signal(&note_cond);
+	pthread_mutex_unlock(&note_mutex);
+}
+
+static void *ui_note_thread(void *arg)
+{
+	struct ui_note n;
+
+	for (;;) {
+		pthread_mutex_lock(&note_mutex);
+		while (note_head == note_tail)
+			pthread_cond_wait(&note_cond, &note_mutex);
+		n = *note_at(note_head++);
+		pthread_mutex_unlock(&note_mutex);
+
+		if (n.cmd[0]) {
+			ui_set_screen_state(1);
+			ui_msg(TIPS, LEFT, "CMD(%s)...", n.cmd);
+			ui_start_process_bar();
+		}
+		switch (n.result) {
+		case NOTE_OKAY:
+			ui_msg(TIPS, LEFT, "RESULT: OKAY");
+			ui_stop_process_bar();
+			break;
+		case NOTE_FAIL:
+			ui_msg(ALERT, LEFT, RESULT_FAIL_STRING "%s)", n.reason);
+			ui_stop_process_bar();
+			break;
+		}
+	}
+	return NULL;
+}
+
+void fastboot_fail(const char *reason)
+{
 	fastboot_ack("FAIL", reason);
+	ui_note_result(NOTE_FAIL, reason);
 }
 
 void fastboot_okay(const char *info)
 {
-	ui_msg(TIPS, LEFT, "RESULT: OKAY");
-	ui_stop_process_bar();
 	fastboot_ack("OKAY", info);
+	ui_note_result(NOTE_OKAY, NULL);
 }
 
 static void cmd_getvar(const char *arg, void *data, unsigned sz)
@@ -297,9 +416,9 @@ again:
 			if (memcmp(buffer, cmd->prefix, cmd->prefix_len))
 				continue;
 			fastboot_state = STATE_COMMAND;
-			ui_set_screen_state(1);
-			ui_msg(TIPS, LEFT, "CMD(%s)...", buffer);
-			ui_start_process_bar();
+			/* before the handler can report progress */
+			ui_reset_progress();
+			ui_note_cmd((const char *) buffer);
 			cmd->handle((const char*) buffer + cmd->prefix_len,
 				    (void*) download_base, download_size);
 			if (fastboot_state == STATE_COMMAND)
@@ -354,6 +473,9 @@ static int fastboot_handler(void *arg)
 
 int fastboot_init(void *base, unsigned size)
 {
+	pthread_t t;
+
+	pthread_create(&t, NULL, ui_note_thread, NULL);
 	download_max = size;
 	download_base = base;
 
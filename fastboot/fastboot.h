@@ -51,6 +51,8 @@ const char *fastboot_getvar(const char *name);
 /* only callable from within a command handler */
 void fastboot_okay(const char *result);
 void fastboot_fail(const char *reason);
+/* send progress text to the host, at most 60 characters per call */
+void fastboot_info(const char *info);
 
 /* write flash flag into file */
 void progress_file_write(char bar_status);
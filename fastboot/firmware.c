@@ -1,7 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <fcntl.h>
-#include <sys/ioctl.h>
 #include <sys/reboot.h>
 
 #include "common.h"
@@ -9,67 +9,38 @@
 
 int get_fw_info(struct scu_ipc_version* version)
 {
-	int devfd, errNo;
-
-	version->count = 16;    /*read back 16 bytes fw info from IPC*/
-	if ((devfd = open(IPC_DEVICE_NAME, O_RDWR)) == -1) {
-			LOGW("unable to open the DEVICE %s\n", IPC_DEVICE_NAME);
-			return -1;
-	}
-
-	if ((errNo = ioctl(devfd, INTE_SCU_IPC_FW_REVISION_GET, version)) < 0) {
-			LOGW("finding fw_info, ioctl for DEVICE %s, returns error-%d\n", IPC_DEVICE_NAME, errNo);
-			close(devfd);
+	if (scu_ipc_fw_version(version) < 0) {
+			LOGW("finding fw_info, ioctl for DEVICE %s, returns error-%d\n", IPC_DEVICE_NAME, errno);
 			return -1;
 	}
-
-	close(devfd);
 	return 0;
 }
 
 int set_power_on_reason(unsigned char rs)
 {
-	int devfd = 0, ret;
-
-	//rbt_reason = RR_SIGNED_MOS;
-
-	if ((devfd = open(IPC_DEVICE_NAME, O_RDWR)) < 0) {
-		LOGE("unable to open the DEVICE %s\n",
-			IPC_DEVICE_NAME);
-		ret = 0;
-		goto err1;
+	if (scu_ipc_write_rr(rs) < 0) {
+		LOGE("ioctl for DEVICE %s, returns error-%d\n", IPC_DEVICE_NAME, errno);
+		return 0;
 	}
-
-	if ((ret = ioctl(devfd, IPC_WRITE_RR_TO_OSNIB, &rs)) < 0) {
-		LOGE("ioctl for DEVICE %s, returns error-%d\n", IPC_DEVICE_NAME, ret);
-		ret = 0;
-		goto err2;
-	}
-	ret = 1;
-err2:
-	close(devfd);
-err1:
-	return ret;
+	return 1;
 }
 
 int get_poweron_reason()
 {
-	int devfd, errNo;
-	unsigned char rbt_reason;
+	unsigned char rbt_reason = 0;
 
-	if ((devfd = open(IPC_DEVICE_NAME, O_RDWR)) < 0) {
+	if (scu_ipc_open() < 0) {
 		LOGE("unable to open the DEVICE %s\n",
 			IPC_DEVICE_NAME);
 		return -1;
 	}
 
-	if ((errNo = ioctl(devfd, IPC_READ_RR_FROM_OSNIB, &rbt_reason)) < 0) {
+	if (scu_ipc_read_rr(&rbt_reason) < 0) {
 		LOGE("ioctl for DEVICE %s, returns error-%d\n",
-			IPC_DEVICE_NAME, errNo);
+			IPC_DEVICE_NAME, errno);
 	}
 
 	LOGI("OSNIBR.RR = %x\n", rbt_reason);
 
 	return rbt_reason;
 }
-
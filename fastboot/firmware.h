@@ -15,17 +15,12 @@
 #ifndef POWER_REASON_H
 #define POWER_REASON_H
 
-#define IPC_DEVICE_NAME		    "/dev/mid_ipc"
-#define IPC_READ_RR_FROM_OSNIB	0xC1
-#define IPC_WRITE_RR_TO_OSNIB	0xC2
-#define IPC_WRITE_ALARM_TO_OSNIB 0xC5
-#define IPC_COLD_RESET		    0xC3
-#define IPC_READ_VBATTCRIT	    0xC4
+#include "../scu_ipc.h"
+
 #define RR_SIGNED_MOS		    0x0
 #define RR_SIGNED_COS           0xa
 #define RR_SIGNED_POS			0x0e
 #define RR_SIGNED_RECOVERY		0x0C
-#define INTE_SCU_IPC_FW_REVISION_GET  0xB0
 
 #define IA32_CPU_OFFSET			0x07
 #define IA32_SUPP_OFFSET			0x09
@@ -36,11 +31,6 @@
 #define IFWI_OFFSET				0x0F
 	
 
-struct scu_ipc_version {
-		unsigned int	count;  /* length of version info */
-		unsigned char	data[16]; /* version data */
-};
-
 int get_fw_info(struct scu_ipc_version* version);
 int set_power_on_reason(unsigned char rs);
 int get_poweron_reason();
@@ -27,6 +27,7 @@
 #include "ufdisk.h"
 #include "power.h"
 #include "firmware.h"
+#include "../telemetry.h"
 
 #define BOOT_LOADER_VERSION		"V0.1"
 
@@ -37,6 +38,7 @@
 #define PRODUCT_DEVICE_ATTR		"ro.product.device"
 #define MAX_NAME_SIZE			128
 #define BUF_SIZE					256
+#define TELEMETRY_FILE			"/logs/battery_telemetry.bin"
 
 enum {
 	ITEM_BOOTLOADER,
@@ -298,10 +300,17 @@ int main(void)
 		ui_msg(TIPS, LEFT, " ");
 	}
 
-	if (ensure_path_mounted("/logs") != 0)
+	if (ensure_path_mounted("/logs") != 0) {
 		LOGE("unable to mount the log partition\n");
-	else
+		telemetry_init(NULL);
+	} else {
 		property_set("service.apk_logfs.enable", "1");
+		telemetry_init(TELEMETRY_FILE);
+	}
+
+	/* fetch the firmware revisions and VBATTCRIT used below at once */
+	if (scu_ipc_probe() < 0)
+		LOGE("unable to probe %s\n", IPC_DEVICE_NAME);
 
 	switch (get_poweron_reason()) {
 	  case RR_SIGNED_COS:
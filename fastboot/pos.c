@@ -34,10 +34,15 @@
 #include "roots.h"
 #include "osip.h"
 #include "power.h"
+#include "../spawn.h"
+#include "../telemetry.h"
+#include "../wakeup.h"
 
 #define CMD_SYSTEM        "system"
 #define CMD_PROXY         "proxy"
-#define SYSTEM_BUF_SIZ     512    /* For system() and popen() calls. */
+#define CMD_BATTERY_LOG   "battery-log"
+#define CMD_WAKEUPS       "wakeups"
+#define CMD_LATENCY       "latency"
 #define MOUNT_POINT_SIZ    50     /* /dev/<whatever> */
 
 void ufdisk_umount_all(void);
@@ -124,18 +129,32 @@ void cmd_erase(const char *part_name, void *data, unsigned sz)
 	else
 		fastboot_fail("unable to format");
 }
+#define SAVE_CHUNK	(1024 * 1024)
 int save_file(void *data, unsigned sz, const char *name)
 {
         FILE *fp = NULL;
+        unsigned done = 0, len;
         int res = 0;
-        if ((fp = fopen(name, "w+")) != NULL)
-            if (sz == fwrite(data, 1, sz, fp))
+        if ((fp = fopen(name, "w+")) != NULL) {
+            for (; done < sz; done += len) {
+                len = sz - done < SAVE_CHUNK ? sz - done : SAVE_CHUNK;
+                if (len != fwrite((char *) data + done, 1, len, fp))
+                    break;
+                ui_set_progress(done + len, sz, "WRITE");
+            }
+            if (done == sz)
                 res = 1;
-        fclose(fp);
+            fclose(fp);
+        }
         fp = NULL;
         return res;
 }
 
+static void extract_progress(unsigned done, unsigned total, void *data)
+{
+        ui_set_progress(done, total, "EXTRACT");
+}
+
 #define OTA_UPDATE_TEMP_BUFFER		512
 #define OPTION_STRING			"--update_package="
 static int ota_update(char *file)
@@ -171,14 +190,30 @@ extern int restore_payload_osii_entry();
 extern int write_stitch_image(void *data, size_t size, int update_number);
 #define IMG_RADIO "/tmp/__radio.img"
 #define IMG_RADIO_RND "/tmp/__radio_rnd.img"
+
+#define CMFWDL_APP "cmfwdl-app"
+#define CMFWDL_MFD_PORTS "-t", "/dev/ttyMFD1", "-p", "/dev/ttyIFX0"
+#ifdef CLVT
+#define CMFWDL_PORTS "-p", "/dev/ttyIFX1"
+#else
+#define CMFWDL_PORTS CMFWDL_MFD_PORTS
+#endif
+
+/* returns 0 when the tool ran and exited successfully */
+static int run_tool(char *const argv[], const struct spawn_opts *opts)
+{
+        struct spawn_result res;
+        int status;
+
+        status = spawn_run(argv, opts, &res);
+        LOGI("%s returns %d (%ld ms)\n", argv[0], status, res.elapsed_ms);
+        return status;
+}
+
 void cmd_flash(const char *arg, void *data, unsigned sz)
 {
-        char buf[SYSTEM_BUF_SIZ];
         int ret = -1;
         struct stat statbuf;
-        int sys_status;
-
-        memset(buf,0,sizeof(buf));
 
         ui_print("FLASH %s...\n", arg);
         if (!strcmp(arg, "boot")) {
@@ -205,45 +240,37 @@ void cmd_flash(const char *arg, void *data, unsigned sz)
                         unlink(IMG_OTA);
                 }
         } else if (!strcmp(arg, "system") || !strcmp(arg, "data")) {
-                #define IMG_FILE "/tmp/_system_or_data.img"
-                if (save_file(data, sz, IMG_FILE)) {
-                        char path[64];
-                        snprintf(path, sizeof(path)-1, "/%s", arg);
-                        if (0 == ensure_path_mounted(path)) {
-                                snprintf(buf, sizeof(buf)-1, "tar xzf %s -C /", IMG_FILE);
-                                buf[sizeof(buf)-1]=0;
-                                if (-1 != system(buf))
-                                        ret = 0;
-                                ensure_path_unmounted(path);
-                        } else
-                                fastboot_fail("fail to mount partition");
-                        unlink(IMG_FILE);
-                }
+                char path[64];
+                snprintf(path, sizeof(path)-1, "/%s", arg);
+                if (0 == ensure_path_mounted(path)) {
+                        /* unpack straight from the download buffer */
+                        char *const tar[] = { "tar", "xzf", "-", "-C", "/", NULL };
+                        struct spawn_opts opts;
+
+                        memset(&opts, 0, sizeof(opts));
+                        opts.input = data;
+                        opts.input_len = sz;
+                        opts.input_progress = extract_progress;
+                        if (run_tool(tar, &opts) == 0)
+                                ret = 0;
+                        ensure_path_unmounted(path);
+                } else
+                        fastboot_fail("fail to mount partition");
         } else if (!strcmp(arg, "radio")) {
                 // Update modem SW.
                  if (save_file(data, sz, IMG_RADIO)) {
-#ifdef CLVT
-                        snprintf(buf, sizeof(buf)-1,"cmfwdl-app -p /dev/ttyIFX1 "
-#else
-                        snprintf(buf, sizeof(buf)-1,"cmfwdl-app -t /dev/ttyMFD1 -p /dev/ttyIFX0 "
-#endif
-                                      "-b %s -f %s", IMG_RADIO, IMG_RADIO);
-                        sys_status = system(buf);
-                        if (WIFEXITED(sys_status) && !WEXITSTATUS(sys_status))
+                        char *const cmd[] = { CMFWDL_APP, CMFWDL_PORTS,
+                                "-b", IMG_RADIO, "-f", IMG_RADIO, NULL };
+                        if (run_tool(cmd, NULL) == 0)
                                 ret = 0;
                         unlink(IMG_RADIO);
                 }
         } else if (!strcmp(arg, "radio_erase_all")) {
                 // Erase all flash, then update modem SW.
                  if (save_file(data, sz, IMG_RADIO)) {
-#ifdef CLVT
-                        snprintf(buf, sizeof(buf)-1,"cmfwdl-app -p /dev/ttyIFX1 "
-#else
-                        snprintf(buf, sizeof(buf)-1,"cmfwdl-app -t /dev/ttyMFD1 -p /dev/ttyIFX0 "
-#endif
-                                      "-e -b %s -f %s", IMG_RADIO, IMG_RADIO);
-                        sys_status = system(buf);
-                        if (WIFEXITED(sys_status) && !WEXITSTATUS(sys_status))
+                        char *const cmd[] = { CMFWDL_APP, CMFWDL_PORTS,
+                                "-e", "-b", IMG_RADIO, "-f", IMG_RADIO, NULL };
+                        if (run_tool(cmd, NULL) == 0)
                                 ret = 0;
                         unlink(IMG_RADIO);
                 }
@@ -263,10 +290,9 @@ void cmd_flash(const char *arg, void *data, unsigned sz)
                 else {
 
                         if (save_file(data, sz, IMG_RADIO_RND)) {
-                                snprintf(buf, sizeof(buf)-1,"cmfwdl-app -t /dev/ttyMFD1 -p /dev/ttyIFX0 "
-                                      "-b %s -r %s", IMG_RADIO, IMG_RADIO_RND);
-                                sys_status = system(buf);
-                                if (WIFEXITED(sys_status) && !WEXITSTATUS(sys_status))
+                                char *const cmd[] = { CMFWDL_APP, CMFWDL_MFD_PORTS,
+                                        "-b", IMG_RADIO, "-r", IMG_RADIO_RND, NULL };
+                                if (run_tool(cmd, NULL) == 0)
                                         ret = 0;
                                 unlink(IMG_RADIO);
                                 unlink(IMG_RADIO_RND);
@@ -275,20 +301,18 @@ void cmd_flash(const char *arg, void *data, unsigned sz)
         } else if (!strcmp(arg, "rnd_erase")) {
                 // Erase RND Cert
                  if (save_file(data, sz, IMG_RADIO)) {
-                            snprintf(buf, sizeof(buf)-1,"cmfwdl-app -t /dev/ttyMFD1 -p /dev/ttyIFX0 "
-                                      "-b %s --erase-rd", IMG_RADIO);
-                            sys_status = system(buf);
-                            if (WIFEXITED(sys_status) && !WEXITSTATUS(sys_status))
+                            char *const cmd[] = { CMFWDL_APP, CMFWDL_MFD_PORTS,
+                                    "-b", IMG_RADIO, "--erase-rd", NULL };
+                            if (run_tool(cmd, NULL) == 0)
                                     ret = 0;
                             unlink(IMG_RADIO);
                 }
         } else if (!strcmp(arg, "rnd_read")) {
                 // Get RND Cert (print out in stdout)
                 if (save_file(data, sz, IMG_RADIO)) {
-                            snprintf(buf, sizeof(buf)-1,"cmfwdl-app -t /dev/ttyMFD1 -p /dev/ttyIFX0 "
-                                      "-b %s -g", IMG_RADIO);
-                            sys_status = system(buf);
-                            if (WIFEXITED(sys_status) && !WEXITSTATUS(sys_status))
+                            char *const cmd[] = { CMFWDL_APP, CMFWDL_MFD_PORTS,
+                                    "-b", IMG_RADIO, "-g", NULL };
+                            if (run_tool(cmd, NULL) == 0)
                                     ret = 0;
                             unlink(IMG_RADIO);
                 }
@@ -297,10 +321,9 @@ void cmd_flash(const char *arg, void *data, unsigned sz)
                 // Get modem HWID (print out in stdout)
                 fastboot_okay("Getting radio HWID...");
                 if (save_file(data, sz, IMG_RADIO)) {
-                            snprintf(buf, sizeof(buf)-1,"cmfwdl-app -t /dev/ttyMFD1 -p /dev/ttyIFX0 "
-                                      "-b %s -h", IMG_RADIO);
-                            sys_status = system(buf);
-                            if (WIFEXITED(sys_status) && !WEXITSTATUS(sys_status))
+                            char *const cmd[] = { CMFWDL_APP, CMFWDL_MFD_PORTS,
+                                    "-b", IMG_RADIO, "-h", NULL };
+                            if (run_tool(cmd, NULL) == 0)
                                     ret = 0;
                             unlink(IMG_RADIO);
                 }
@@ -334,6 +357,57 @@ err:
         }
 }
 
+/* send the newest battery samples (all if count is 0) as INFO lines,
+   then the wakeup counter records kept next to them */
+static void dump_battery_log(int count)
+{
+	static struct telemetry_sample samples[TELEMETRY_SAMPLES];
+	static struct telemetry_counter counters[TELEMETRY_COUNTERS];
+	struct telemetry_sample *s;
+	struct telemetry_counter *c;
+	char line[64];
+	int i, n;
+
+	telemetry_flush();
+	if (count <= 0 || count > TELEMETRY_SAMPLES)
+		count = TELEMETRY_SAMPLES;
+	n = telemetry_snapshot(samples, count);
+	for (i = 0; i < n; i++) {
+		s = &samples[i];
+		snprintf(line, sizeof(line), "%u.%03u %dmV %dmA %d%% %d.%dC %s %d",
+			 s->time_ms / 1000, s->time_ms % 1000,
+			 s->voltage / 1000, s->current / 1000, s->capacity,
+			 s->temp / 10, abs(s->temp % 10),
+			 (s->flags & TELEMETRY_CHARGER) ? "chg" : "bat",
+			 s->flags >> TELEMETRY_STATUS_SHIFT);
+		fastboot_info(line);
+	}
+
+	if (count > TELEMETRY_COUNTERS)
+		count = TELEMETRY_COUNTERS;
+	n = telemetry_counter_snapshot(counters, count);
+	for (i = 0; i < n; i++) {
+		c = &counters[i];
+		snprintf(line, sizeof(line), "%u.%03u wakeup %u %u %ums",
+			 c->time_ms / 1000, c->time_ms % 1000,
+			 c->id, c->count, c->cpu_ms);
+		fastboot_info(line);
+	}
+}
+
+static void dump_wakeup(const struct wakeup_source *ws, void *data)
+{
+	char line[64];
+
+	wakeup_format(ws, line, sizeof(line));
+	fastboot_info(line);
+}
+
+static void dump_latency(const char *line, void *data)
+{
+	fastboot_info(line);
+}
+
 void cmd_oem(const char *arg, void *data, unsigned sz)
 {
         const char *command;
@@ -403,6 +477,30 @@ void cmd_oem(const char *arg, void *data, unsigned sz)
                     fastboot_okay("");
                 }
 
+        /* "battery-log" command */
+        } else if (strncmp(command, CMD_BATTERY_LOG, strlen(CMD_BATTERY_LOG)) == 0) {
+                arg += strlen(CMD_BATTERY_LOG);
+                dump_battery_log(atoi(arg));
+                fastboot_okay("");
+
+        /* "wakeups" command */
+        } else if (strncmp(command, CMD_WAKEUPS, strlen(CMD_WAKEUPS)) == 0) {
+                wakeup_each(dump_wakeup, NULL);
+                fastboot_okay("");
+
+        /* "latency [on|off]" command, on/off toggles the overlay and
+           the per key log */
+        } else if (strncmp(command, CMD_LATENCY, strlen(CMD_LATENCY)) == 0) {
+                arg += strlen(CMD_LATENCY);
+                while (*arg == ' ')
+                        arg++;
+                if (!strcmp(arg, "on"))
+                        ui_latency_overlay(1);
+                else if (!strcmp(arg, "off"))
+                        ui_latency_overlay(0);
+                ui_latency_each(dump_latency, NULL);
+                fastboot_okay("");
+
         } else {
                 fastboot_fail("unknown OEM command");
         }
@@ -21,10 +21,14 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <pthread.h>
-#include <dirent.h>
+#include <semaphore.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "minui.h"
 #include "common.h"
+#include "../backlight.h"
 
 //color table, BGRA format
 struct color white = {223, 215, 200, 255};
@@ -112,6 +116,91 @@ static int show_process = 0;
 static int process_frame = 0;
 static volatile char process_update = 0;
 
+/* determinate progress, under gUpdateMutex. gProgressPercent is -1
+   while the indeterminate animation runs. */
+#define PROGRESS_SAMPLE_MS 250
+static int gProgressPercent = -1;
+static unsigned long long gProgressTotal, gProgressLast;
+static long gProgressLastMs;
+static double gProgressRate;		/* smoothed, bytes per ms */
+static char gProgressPhase[16];
+
+/* one frame per 60 Hz vsync at most */
+#define FRAME_MS 16
+
+/* the render thread sleeps on gRenderSem, gRenderWake is set while a
+   wake-up is pending so a burst of marks posts it once */
+static sem_t gRenderSem;
+static volatile int gRenderWake;
+
+/* what the render thread has to redraw, under gUpdateMutex */
+static unsigned long long gDirtyRows;	/* bit n: text row n */
+#define ROWS(top, n)	(((1ULL << (n)) - 1) << (top))
+static int gDirtyFull;
+static int gDirtyProgress;
+
+/* the times of a key on its way to the screen, in microseconds of
+   CLOCK_MONOTONIC, 0 until reached */
+struct key_trace {
+	int code;
+	long long input;	/* kernel input event */
+	long long queued;	/* input_callback() */
+	long long dequeued;	/* ui_wait_key() */
+	long long marked;	/* ui_menu_select() */
+	long long snapshot;	/* picked up by the render thread */
+};
+
+/* the state a frame is drawn from, copied out of the blocks so the
+   drawing and the flip happen without gUpdateMutex held */
+static struct {
+	unsigned long long rows;
+	int full, progress;
+	gr_surface icon;
+	int show_process, process_frame, percent;
+	char text[MAX_ROWS][MAX_COLS];
+	struct color *clr[MAX_ROWS];
+	struct key_trace trace;
+	int traced;
+} frame;
+
+/* each background icon composited with the black_tr overlay, as the
+   memory surface holds it, so a frame copies it in instead of blending */
+struct bg_cache {
+	gr_surface icon;
+	unsigned char *pixels;
+};
+
+static struct bg_cache bg_cache[NUM_BACKGROUND_ICONS];
+static int fb_pixel_size;	/* 0 if the memory surface is not readable */
+
+/* what each text row of minui's memory surface shows, so a row marked
+   with the same text and color is not rasterized again. render thread
+   only. */
+static struct {
+	char text[MAX_ROWS][MAX_COLS];
+	struct color *clr[MAX_ROWS];
+} shown;
+
+/*
+ * ui_print() lines on their way to the log block. ui_print() writes
+ * the line to stdout itself, the ring only feeds the screen. Any thread
+ * appends without locking: it claims a position by moving log_ring_tail,
+ * fills the slot and publishes it through the slot state, 2 * lap while
+ * the slot is free for the given lap and 2 * lap + 1 once written. The
+ * render thread alone consumes from log_ring_head. A full ring drops
+ * the line from the screen rather than wait.
+ */
+#define LOG_RING	64	/* power of two */
+#define LOG_LINE	256
+
+static struct {
+	volatile unsigned state;
+	char text[LOG_LINE];
+} log_ring[LOG_RING];
+static volatile unsigned log_ring_tail;
+static unsigned log_ring_head;
+static volatile unsigned log_ring_lost;
+
 static const struct { gr_surface* surface; const char *name; } BITMAPS[] = {
     { &gBackgroundIcon[BACKGROUND_ICON_BACKGROUND], "background" },
     { &gBackgroundIcon[BACKGROUND_ICON_ERR],        "bat_err" },
@@ -134,22 +223,41 @@ static const struct { gr_surface* surface; const char *name; } BITMAPS[] = {
     { NULL,                             				NULL },
 };
 
-// Key event input queue
+/*
+ * Key event input queue, a ring from key_queue_head to key_queue_tail
+ * under key_queue_mutex. Each key carries its struct key_trace.
+ */
+#define KEY_QUEUE 256	/* power of two */
 static pthread_mutex_t key_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t key_queue_cond = PTHREAD_COND_INITIALIZER;
-static int key_queue[256], key_queue_len = 0;
+static struct key_trace key_queue[KEY_QUEUE];
+static unsigned key_queue_head, key_queue_tail;
+static struct key_trace gKeyTrace;	/* the last key returned */
 static volatile char key_pressed[KEY_MAX + 1];
 
+/* input-to-photon latency of the menu keys, under gUpdateMutex: the
+   key whose menu change waits for a frame, and a histogram of the
+   totals. The debug overlay shows the histogram on LATENCY_ROW, and
+   while it is on every key is logged with its breakdown. */
+#define LATENCY_BUCKETS 8
+#define LATENCY_LOG_KEYS 32
+#define LATENCY_ROW (MENU_TOP + MENU_MAX + BLANK_SIZE)
+static const int latency_bounds[LATENCY_BUCKETS - 1] = {
+	8, 16, 33, 50, 100, 200, 500	/* ms */
+};
+static struct key_trace gTracePending;
+static int gTraceWaiting;
+static unsigned latency_hist[LATENCY_BUCKETS], latency_count;
+static long long latency_max;
+static int gLatencyOverlay;
+
 #define SCREENSAVER_DELAY 30000
 #define BRIGHTNESS_DELAY 100
+#define BRIGHTNESS_STEP 10
 #define TARGET_BRIGHTNESS 40
-#define SYSFS_BACKLIGHT "/sys/devices/virtual/backlight"
 
 static ui_timer_t *gScreenSaverTimer;
-static ui_timer_t *gBrightnessTimer;
 static ui_timer_t *gProgressTimer;
-static int gCurBrightness = TARGET_BRIGHTNESS;
-static char gBrightnessPath[255];
 static int gScreenState = 1;
 static int gTargetScreenState = 1;
 static int default_screensaver_delay = SCREENSAVER_DELAY;
@@ -159,49 +267,20 @@ static int default_screensaver_delay = SCREENSAVER_DELAY;
 extern int set_screen_state(int);
 extern int acquire_wake_lock(int, const char*);
 
-static int set_back_brightness_timer(void*data)
-{
-	int ret = TIMER_STOP;
-	char buf[32];
-	FILE *file;
-	struct dirent *entry;
-	DIR *dir;
-	int val;
-	const char *name;
-	char *path = gBrightnessPath;
-	if(path[0]==0) {
-		dir = opendir(SYSFS_BACKLIGHT);
-		if (dir == NULL) {
-			ui_print("Could not open %s\n", SYSFS_BACKLIGHT);
-			return TIMER_STOP;
-		}
-		while ((entry = readdir(dir))) {
-			name = entry->d_name;
-			snprintf(path, 255, "%s/%s/brightness", SYSFS_BACKLIGHT, name);
-			if (access(path, 0) == 0) {
-				break;
-			}
-		}
-		closedir(dir);
-	}
-	val = gCurBrightness;
-	if(gTargetScreenState && gCurBrightness < TARGET_BRIGHTNESS)
-		val += 10;
-	if(gTargetScreenState == 0 && gCurBrightness > 0)
-		val -= 10;
-
-	if (val != gCurBrightness &&
-		(file = fopen(path, "w+")) != NULL) {
-		snprintf(buf, 32, "%d", val);
-		fwrite(buf, strlen(buf), 1, file);
-		gCurBrightness = val;
-		fclose(file);
-		ret = TIMER_AGAIN;
-		if(val == 0)
+/* ramps the backlight, the ramp timer is its only wake-up */
+static void *backlight_thread(void *cookie)
+{
+	struct pollfd pfd;
+
+	pfd.fd = backlight_ramp_fd();
+	pfd.events = POLLIN;
+	for (;;) {
+		if (poll(&pfd, 1, -1) <= 0)
+			continue;
+		if (backlight_ramp_run() == 1 && gTargetScreenState == 0)
 			set_screen_state(0);
 	}
-
-	return ret;
+	return NULL;
 }
 
 void ui_set_screen_state(int state)
@@ -213,7 +292,8 @@ void ui_set_screen_state(int state)
 	gTargetScreenState = state;
 	if(state)
 		set_screen_state(state);
-	ui_start_timer(gBrightnessTimer, BRIGHTNESS_DELAY);
+	backlight_ramp(state ? TARGET_BRIGHTNESS : 0, BRIGHTNESS_STEP,
+		       BRIGHTNESS_DELAY);
 }
 
 int ui_get_screen_state(void)
@@ -279,42 +359,54 @@ static void ui_gr_color(struct color* clr)
 	gr_color(clr->r, clr->g, clr->b, clr->a);
 }
 
-static void ui_gr_color_fill(struct color* clr)
+/* coordinates of the progress bar, and its current frame */
+static void progress_rect(int *x, int *y, int *w, int *h)
 {
-	ui_gr_color(clr);
-	gr_fill(0, 0, fb_width, fb_height);
+	if (gProgressBarIndeterminate[0]) {
+		*w = gr_get_width(gProgressBarIndeterminate[0]);
+		*h = gr_get_height(gProgressBarIndeterminate[0]);
+	} else {
+		*w = fb_width * 3 / 4;
+		*h = CHAR_HEIGHT / 2;
+	}
+	*x = (fb_width - *w) / 2;
+	*y = fb_height - 1.5 * CHAR_HEIGHT;
 }
 
-// Draw the progress bar (if any) on the screen.  Does not flip pages.
-// Should only be called with gUpdateMutex locked.
-static void draw_progress_locked()
+static void wake_renderer(void)
 {
-	int width = gr_get_width(gProgressBarIndeterminate[0]);
-	int height = gr_get_height(gProgressBarIndeterminate[0]);
-
-	int dx = (fb_width - width)/2;
-	int dy = fb_height - 1.5 * CHAR_HEIGHT;
+	if (!__sync_lock_test_and_set(&gRenderWake, 1))
+		sem_post(&gRenderSem);
+}
 
-	// Erase behind the progress bar (in case this was a progress-only update)
-	gr_color(0, 0, 0, 255);
-	gr_fill(dx, dy, width, height);
+// Mark part of the screen for the render thread.
+// Should only be called with gUpdateMutex locked.
+static void mark_rows_locked(int top, int rows)
+{
+	gDirtyRows |= ROWS(top, rows);
+	wake_renderer();
+}
 
-	gr_blit(gProgressBarIndeterminate[process_frame], 0, 0, width, height, dx, dy);
+static void mark_block_locked(int type)
+{
+	mark_rows_locked(UI_BLOCK[type].top, UI_BLOCK[type].rows);
 }
 
-static void update_progress_locked(void)
+static void mark_full_locked(void)
 {
-	draw_progress_locked();  // Draw only the progress bar
-	gr_flip();
+	gDirtyFull = 1;
+	wake_renderer();
 }
 
 static int progress_timer_cb(void *data)
 {
 	if (process_update) {
-		if (show_process) {
+		/* a determinate bar only moves with ui_set_progress() */
+		if (show_process && gProgressPercent < 0) {
 			pthread_mutex_lock(&gUpdateMutex);
-			update_progress_locked();
 			process_frame = (process_frame + 1) % PROGRESSBAR_INDETERMINATE_STATES;
+			gDirtyProgress = 1;
+			wake_renderer();
 			pthread_mutex_unlock(&gUpdateMutex);
 		}
 		return TIMER_AGAIN;
@@ -322,22 +414,204 @@ static int progress_timer_cb(void *data)
 		return TIMER_STOP;
 }
 
+/* upper bound in ms of the bucket holding pct percent of the keys,
+   -1 past the last bound */
+static int latency_percentile_locked(int pct)
+{
+	unsigned n = 0;
+	int i;
 
-// Clear the screen and draw the currently selected background icon (if any).
+	for (i = 0; i < LATENCY_BUCKETS - 1; i++) {
+		n += latency_hist[i];
+		if (n * 100 >= latency_count * pct)
+			return latency_bounds[i];
+	}
+	return -1;
+}
+
+static void latency_summary_locked(char *buf, int size)
+{
+	int p50 = latency_percentile_locked(50);
+	int p90 = latency_percentile_locked(90);
+
+	if (!latency_count) {
+		snprintf(buf, size, "KEY LATENCY: NO KEYS YET");
+		return;
+	}
+	snprintf(buf, size, "KEY LATENCY: %u KEYS, P50 %s%dMS, P90 %s%dMS, MAX %lldMS",
+		 latency_count,
+		 p50 < 0 ? ">" : "<", p50 < 0 ? latency_bounds[LATENCY_BUCKETS - 2] : p50,
+		 p90 < 0 ? ">" : "<", p90 < 0 ? latency_bounds[LATENCY_BUCKETS - 2] : p90,
+		 latency_max / 1000);
+}
+
+// Copy what the next frame needs out of the blocks and clear the marks.
 // Should only be called with gUpdateMutex locked.
-static void draw_background_locked(gr_surface icon)
+static void snapshot_locked(void)
+{
+	struct ui_block *b;
+	const char *t;
+	int i, j, row;
+
+	frame.full = gDirtyFull;
+	frame.rows = gDirtyFull ? ~0ULL : gDirtyRows;
+	frame.progress = gDirtyProgress;
+	frame.icon = gCurrentIcon;
+	frame.show_process = show_process;
+	frame.process_frame = process_frame;
+	frame.percent = gProgressPercent;
+	frame.traced = gTraceWaiting;
+	frame.trace = gTracePending;
+	gDirtyRows = 0;
+	gDirtyFull = gDirtyProgress = 0;
+	gTraceWaiting = 0;
+
+	for (row = 0; row < MAX_ROWS; row++)
+		if (frame.rows & 1ULL << row) {
+			frame.text[row][0] = '\0';
+			frame.clr[row] = NULL;
+		}
+	/* the blocks do not overlap */
+	for (i = 0; i < BLOCK_NUM; i++) {
+		b = &UI_BLOCK[i];
+		if (b->show != VISIBLE)
+			continue;
+		for (j = 0; j < b->rows; j++) {
+			row = b->top + j;
+			if (!(frame.rows & 1ULL << row))
+				continue;
+			if (i == LOG) {
+				t = b->text_table[(j + log_top) % b->rows];
+				frame.clr[row] = b->clr_table[0];
+			} else {
+				t = b->text_table[j];
+				frame.clr[row] = b->clr_table[j];
+			}
+			strncpy(frame.text[row], t, MAX_COLS - 1);
+			frame.text[row][MAX_COLS - 1] = '\0';
+		}
+	}
+	if (gLatencyOverlay && frame.rows & 1ULL << LATENCY_ROW) {
+		latency_summary_locked(frame.text[LATENCY_ROW], MAX_COLS);
+		frame.clr[LATENCY_ROW] = &yellow;
+	}
+}
+
+/* blit the lines [y, y + h) of surface s, which sits at (x, top) */
+static void blit_lines(gr_surface s, int x, int top, int y, int h)
+{
+	int from = y > top ? y : top;
+	int to = top + gr_get_height(s);
+
+	if (to > y + h)
+		to = y + h;
+	if (from < to)
+		gr_blit(s, 0, from - top, gr_get_width(s), to - from, x, from);
+}
+
+/* the progress bar within the lines [y, y + h), under the black_tr
+   overlay if overlay is set */
+static void draw_progress(int y, int h, int overlay)
+{
+	int px, py, pw, ph, from, to;
+
+	progress_rect(&px, &py, &pw, &ph);
+	if (py + ph <= y || py >= y + h)
+		return;
+	from = py > y ? py : y;
+	to = py + ph < y + h ? py + ph : y + h;
+	// Erase behind the progress bar (in case this was a progress-only update)
+	gr_color(0, 0, 0, 255);
+	gr_fill(px, from, px + pw, to);
+	if (frame.percent >= 0) {
+		ui_gr_color(&gray);
+		gr_fill(px, from, px + pw, to);
+		ui_gr_color(&green);
+		gr_fill(px, from, px + pw * frame.percent / 100, to);
+	} else if (gProgressBarIndeterminate[frame.process_frame])
+		blit_lines(gProgressBarIndeterminate[frame.process_frame], px, py, y, h);
+	if (overlay) {
+		ui_gr_color(&black_tr);
+		gr_fill(px, from, px + pw, to);
+	}
+}
+
+/* minui's memory surface is fb_width pixels per line. find the bytes
+   per pixel by lighting one and looking where its bytes start. */
+static void probe_pixel_size(void)
+{
+	unsigned char *fb = (unsigned char *) gr_fb_data();
+	unsigned char ref[16];
+	int d;
+
+	if (fb == NULL || fb_width < 4)
+		return;
+	gr_color(0, 0, 0, 255);
+	gr_fill(0, 0, fb_width, 1);
+	memcpy(ref, fb, sizeof(ref));
+	gr_color(255, 255, 255, 255);
+	gr_fill(1, 0, 2, 1);
+	for (d = 0; d < (int) sizeof(ref) && fb[d] == ref[d]; d++)
+		;
+	/* the first changed byte is in the second pixel */
+	if (d == 2 || d == 3)
+		fb_pixel_size = 2;
+	else if (d >= 4 && d < 8)
+		fb_pixel_size = 4;
+	gr_color(0, 0, 0, 255);
+	gr_fill(0, 0, fb_width, 1);
+}
+
+static struct bg_cache *bg_cache_get(gr_surface icon)
 {
-	ui_gr_color_fill(&black);
+	int i;
 
-	if (icon) {
-		int iconWidth = gr_get_width(icon);
-		int iconHeight = gr_get_height(icon);
-		int iconX = (fb_width - iconWidth) / 2;
-		int iconY = (fb_height - iconHeight) / 2;
-		gr_blit(icon, 0, 0, iconWidth, iconHeight, iconX, iconY);
+	if (!fb_pixel_size)
+		return NULL;
+	for (i = 0; i < NUM_BACKGROUND_ICONS; i++) {
+		if (bg_cache[i].icon == icon)
+			return &bg_cache[i];
+		if (bg_cache[i].icon == NULL) {
+			bg_cache[i].icon = icon;
+			return &bg_cache[i];
+		}
 	}
-	if (show_process)
-		draw_progress_locked();
+	return NULL;
+}
+
+/* the background icon and the overlay above it within the lines
+   [y, y + h): copied from the cache, or drawn and then cached if the
+   whole icon was drawn */
+static void draw_icon(gr_surface icon, int y, int h)
+{
+	unsigned char *fb = (unsigned char *) gr_fb_data();
+	int w = gr_get_width(icon), ih = gr_get_height(icon);
+	int x = (fb_width - w) / 2, top = (fb_height - ih) / 2;
+	int from = y > top ? y : top, to = top + ih;
+	int line = w * fb_pixel_size, i;
+	struct bg_cache *c = NULL;
+
+	if (to > y + h)
+		to = y + h;
+	if (from >= to)
+		return;
+	if (x >= 0 && top >= 0)
+		c = bg_cache_get(icon);
+	if (c && c->pixels) {
+		for (i = from; i < to; i++)
+			memcpy(fb + (i * fb_width + x) * fb_pixel_size,
+			       c->pixels + (i - top) * line, line);
+		return;
+	}
+
+	blit_lines(icon, x, top, y, h);
+	ui_gr_color(&black_tr);
+	gr_fill(x, from, x + w, to);
+	if (c && from == top && to == top + ih &&
+	    (c->pixels = malloc(line * ih)) != NULL)
+		for (i = from; i < to; i++)
+			memcpy(c->pixels + (i - top) * line,
+			       fb + (i * fb_width + x) * fb_pixel_size, line);
 }
 
 static void draw_text_line(int row, const char* t) {
@@ -345,35 +619,207 @@ static void draw_text_line(int row, const char* t) {
 	gr_text(0, (row+1)*CHAR_HEIGHT-1, t);
   }
 }
-// Redraw everything on the screen.  Does not flip pages.
-// Should only be called with gUpdateMutex locked.
-static void draw_screen_locked()
+
+/* redraw the screen lines [y, y + h): background, overlay and the
+   text rows in them, which must be part of the snapshot */
+static void draw_lines(int y, int h)
 {
-	int i, j;
+	int row;
+
+	/* black under the black_tr overlay stays black, only the icon
+	   and the progress bar need compositing */
+	ui_gr_color(&black);
+	gr_fill(0, y, fb_width, y + h);
+	if (frame.icon)
+		draw_icon(frame.icon, y, h);
+	if (frame.show_process)
+		draw_progress(y, h, 1);
+
+	for (row = y / CHAR_HEIGHT; row < MAX_ROWS && row * CHAR_HEIGHT < y + h; row++)
+		if (frame.text[row][0] != '\0') {
+			ui_gr_color(frame.clr[row]);
+			draw_text_line(row, frame.text[row]);
+		}
+}
 
-	draw_background_locked(gCurrentIcon);
-	ui_gr_color_fill(&black_tr);
-	for (i = 0; i < BLOCK_NUM; i++)
-		if (UI_BLOCK[i].show == VISIBLE) {
-			if (i == LOG) {
-				ui_gr_color(UI_BLOCK[i].clr_table[0]);
-				for (j = 0; j < UI_BLOCK[i].rows; j++)
-					draw_text_line(UI_BLOCK[i].top+j, UI_BLOCK[i].text_table[(j+log_top) % UI_BLOCK[i].rows]);
-			} else {
-				for (j = 0; j < UI_BLOCK[i].rows; j++) {
-					ui_gr_color(UI_BLOCK[i].clr_table[j]);
-					draw_text_line(UI_BLOCK[i].top+j, UI_BLOCK[i].text_table[j]);
-				}
-			}
+/* gr_flip() copies minui's memory surface out, so everything left
+   alone keeps what the previous frame drew there. returns 0 if there
+   was nothing to draw. */
+static int draw_frame(void)
+{
+	int row, top;
+
+	for (row = 0; row < MAX_ROWS; row++) {
+		if (!(frame.rows & 1ULL << row))
+			continue;
+		if (!frame.full && frame.clr[row] == shown.clr[row] &&
+		    !strcmp(frame.text[row], shown.text[row])) {
+			frame.rows &= ~(1ULL << row);
+			continue;
 		}
+		strcpy(shown.text[row], frame.text[row]);
+		shown.clr[row] = frame.clr[row];
+	}
+
+	if (frame.full)
+		draw_lines(0, fb_height);
+	else {
+		for (row = 0; row < MAX_ROWS; row++) {
+			if (!(frame.rows & 1ULL << row))
+				continue;
+			for (top = row; row < MAX_ROWS && frame.rows & 1ULL << row; row++)
+				;
+			draw_lines(top * CHAR_HEIGHT, (row - top) * CHAR_HEIGHT);
+		}
+	}
+	if (frame.progress && frame.show_process)
+		draw_progress(0, fb_height, 0);
+	return frame.full || frame.rows || (frame.progress && frame.show_process);
+}
+
+static long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
 }
 
-// Redraw everything on the screen and flip the screen (make it visible).
+/* account a menu key whose change just made it to the screen */
+static void latency_record(struct key_trace *t)
+{
+	long long flipped = now_us(), total = flipped - t->input;
+	unsigned count;
+	char line[MAX_COLS];
+	int i, verbose;
+
+	for (i = 0; i < LATENCY_BUCKETS - 1; i++)
+		if (total < latency_bounds[i] * 1000LL)
+			break;
+
+	pthread_mutex_lock(&gUpdateMutex);
+	latency_hist[i]++;
+	count = ++latency_count;
+	if (total > latency_max)
+		latency_max = total;
+	if (count % LATENCY_LOG_KEYS == 0)
+		latency_summary_locked(line, sizeof(line));
+	verbose = gLatencyOverlay;
+	if (verbose)
+		mark_rows_locked(LATENCY_ROW, 1);
+	pthread_mutex_unlock(&gUpdateMutex);
+
+	/* the per key breakdown only while "oem latency on" */
+	if (verbose)
+			LOGI("key %d: %lld us (input %lld, queue %lld, menu %lld, frame %lld, flip %lld)\n",
+		     t->code, total, t->queued - t->input, t->dequeued - t->queued,
+		     t->marked - t->dequeued, t->snapshot - t->marked,
+		     flipped - t->snapshot);
+	if (count % LATENCY_LOG_KEYS == 0)
+		LOGI("%s\n", line);
+}
+
+// Add text to the log block.
 // Should only be called with gUpdateMutex locked.
-static void update_screen_locked(void)
+static void log_append_locked(const char *buf)
+{
+	int old_top = log_top, old_row = log_row, first;
+	const char *ptr = buf;
+
+	for (; *ptr != '\0'; ++ptr) {
+		if (*ptr == '\r') {
+			log[log_row][log_col] = '\0';
+			log_col = 0;
+		}
+		if (*ptr == '\n' || log_col >= MAX_COLS - 1) {
+			log[log_row][log_col] = '\0';
+			log_col = 0;
+			log_row = (log_row + 1) % LOG_MAX;
+			if (log_row == log_top) log_top = (log_top + 1) % LOG_MAX;
+		}
+		if ((*ptr != '\n') && (*ptr != '\r')) {
+			log[log_row][log_col] = *ptr;
+			log_col++;
+		}
+	}
+	log[log_row][log_col] = '\0';
+	/* a scroll moves every row, otherwise only the rows written changed.
+	   the render thread calls this right before its snapshot, no need
+	   to wake it up. */
+	if (log_top != old_top)
+		gDirtyRows |= ROWS(LOG_TOP, LOG_MAX);
+	else {
+		first = (old_row - log_top + LOG_MAX) % LOG_MAX;
+		gDirtyRows |= ROWS(LOG_TOP + first,
+				   (log_row - log_top + LOG_MAX) % LOG_MAX - first + 1);
+	}
+}
+
+/* move the published ui_print() lines to the log block */
+static void drain_log_ring(void)
 {
-	draw_screen_locked();
-	gr_flip();
+	char buf[LOG_LINE];
+	unsigned lost;
+	int slot;
+
+	for (;;) {
+		slot = log_ring_head % LOG_RING;
+		if (log_ring[slot].state != 2 * (log_ring_head / LOG_RING) + 1)
+			break;
+		__sync_synchronize();
+		memcpy(buf, log_ring[slot].text, LOG_LINE);
+		__sync_synchronize();
+		log_ring[slot].state = 2 * (log_ring_head / LOG_RING + 1);
+		log_ring_head++;
+
+		pthread_mutex_lock(&gUpdateMutex);
+		log_append_locked(buf);
+		pthread_mutex_unlock(&gUpdateMutex);
+	}
+	if ((lost = __sync_lock_test_and_set(&log_ring_lost, 0)))
+		printf("ui: %u log lines not shown on screen\n", lost);
+}
+
+/* the only thread drawing: the callers mark what changed and go on,
+   and a burst of updates ends up in one frame per FRAME_MS */
+static void *render_thread(void *cookie)
+{
+	long last = 0, wait;
+	int dirty;
+
+	for (;;) {
+		while (sem_wait(&gRenderSem) < 0 && errno == EINTR)
+			;
+		wait = last + FRAME_MS - now_ms();
+		if (wait > 0)
+			usleep(wait * 1000);
+		/* whatever is marked from now on needs another frame */
+		__sync_lock_release(&gRenderWake);
+
+		drain_log_ring();
+		pthread_mutex_lock(&gUpdateMutex);
+		dirty = gDirtyRows || gDirtyFull || gDirtyProgress;
+		if (dirty)
+			snapshot_locked();
+		pthread_mutex_unlock(&gUpdateMutex);
+		if (dirty && frame.traced)
+			frame.trace.snapshot = now_us();
+		if (!dirty || !draw_frame())
+			continue;
+		gr_flip();
+		last = now_ms();
+		if (frame.traced)
+			latency_record(&frame.trace);
+	}
+	return NULL;
 }
 
 static void set_block_text(int type, char **text)
@@ -395,19 +841,28 @@ static void set_block_clr(int type, struct color *clr)
 		UI_BLOCK[type].clr_table[i] = clr;
 }
 
-static void update_block(int type, int visible)
+// Should only be called with gUpdateMutex locked.
+static void update_block_locked(int type, int visible)
 {
 	UI_BLOCK[type].show = visible;
+	mark_block_locked(type);
+}
+
+void ui_set_background(int icon)
+{
 	pthread_mutex_lock(&gUpdateMutex);
-	update_screen_locked();
+	if (gCurrentIcon != gBackgroundIcon[icon]) {
+		gCurrentIcon = gBackgroundIcon[icon];
+		mark_full_locked();
+	}
 	pthread_mutex_unlock(&gUpdateMutex);
 }
 
-void ui_set_background(int icon)
+void ui_reset_progress(void)
 {
 	pthread_mutex_lock(&gUpdateMutex);
-	gCurrentIcon = gBackgroundIcon[icon];
-	update_screen_locked();
+	gProgressPercent = -1;
+	gProgressTotal = 0;
 	pthread_mutex_unlock(&gUpdateMutex);
 }
 
@@ -419,7 +874,12 @@ void ui_start_process_bar()
 
 void ui_show_process(int show)
 {
-	show_process = show;
+	pthread_mutex_lock(&gUpdateMutex);
+	if (show_process != show) {
+		show_process = show;
+		mark_full_locked();
+	}
+	pthread_mutex_unlock(&gUpdateMutex);
 }
 
 void ui_stop_process_bar()
@@ -427,26 +887,79 @@ void ui_stop_process_bar()
 	process_update = 0;
 }
 
+void ui_set_progress(unsigned long long done, unsigned long long total,
+		     const char *phase)
+{
+	long now = now_ms(), dt;
+	double rate;
+	int percent, eta;
+
+	if (total == 0)
+		return;
+	if (done > total)
+		done = total;
+
+	pthread_mutex_lock(&gUpdateMutex);
+	if (total != gProgressTotal || done < gProgressLast ||
+	    strncmp(phase, gProgressPhase, sizeof(gProgressPhase) - 1)) {
+		/* a new transfer */
+		gProgressTotal = total;
+		gProgressLast = done;
+		gProgressLastMs = now;
+		gProgressRate = 0;
+		gProgressPercent = -1;
+		strncpy(gProgressPhase, phase, sizeof(gProgressPhase) - 1);
+	} else if ((dt = now - gProgressLastMs) >= PROGRESS_SAMPLE_MS) {
+		/* smooth out the USB and writeback bursts */
+		rate = (double) (done - gProgressLast) / dt;
+		gProgressRate = gProgressRate > 0 ?
+			0.8 * gProgressRate + 0.2 * rate : rate;
+		gProgressLast = done;
+		gProgressLastMs = now;
+	}
+
+	percent = done * 100 / total;
+	if (percent != gProgressPercent) {
+		gProgressPercent = percent;
+		if (gProgressRate > 0 && done < total) {
+			eta = (total - done) / gProgressRate / 1000;
+			snprintf(msg[0], MAX_COLS, "%s %d%%, %d:%02d LEFT",
+				 gProgressPhase, percent, eta / 60, eta % 60);
+		} else
+			snprintf(msg[0], MAX_COLS, "%s %d%%", gProgressPhase, percent);
+		msg_clr[0] = msg_dclr;
+		gDirtyProgress = 1;
+		mark_block_locked(MSG);
+	}
+	pthread_mutex_unlock(&gUpdateMutex);
+}
+
 void ui_block_init(int type, char **titles, struct color **clrs)
 {
 	int i;
 
+	pthread_mutex_lock(&gUpdateMutex);
 	for (i = 0; i < UI_BLOCK[type].rows; i++) {
 		if (clrs[i] == NULL) break;
 		UI_BLOCK[type].clr_table[i] = clrs[i];
 	}
 	set_block_text(type, titles);
-	update_block(type, VISIBLE);
+	update_block_locked(type, VISIBLE);
+	pthread_mutex_unlock(&gUpdateMutex);
 }
 
 void ui_block_show(int type)
 {
-	UI_BLOCK[type].show = VISIBLE;
+	pthread_mutex_lock(&gUpdateMutex);
+	update_block_locked(type, VISIBLE);
+	pthread_mutex_unlock(&gUpdateMutex);
 }
 
 void ui_block_hide(int type)
 {
-	UI_BLOCK[type].show = HIDDEN;
+	pthread_mutex_lock(&gUpdateMutex);
+	update_block_locked(type, HIDDEN);
+	pthread_mutex_unlock(&gUpdateMutex);
 }
 
 int ui_block_visible(int type)
@@ -456,34 +969,36 @@ int ui_block_visible(int type)
 
 void ui_print(const char *fmt, ...)
 {
-	char buf[256];
+	char buf[LOG_LINE];
+	unsigned pos, state, lap;
 	va_list ap;
+	int slot;
+
 	va_start(ap, fmt);
-	vsnprintf(buf, 256, fmt, ap);
+	vsnprintf(buf, LOG_LINE, fmt, ap);
 	va_end(ap);
-
 	fputs(buf, stdout);
-	pthread_mutex_lock(&gUpdateMutex);
-	char *ptr = buf;
-	for (; *ptr != '\0'; ++ptr) {
-		if (*ptr == '\r') {
-			log[log_row][log_col] = '\0';
-			log_col = 0;
-		}
-		if (*ptr == '\n' || log_col >= MAX_COLS) {
-			log[log_row][log_col] = '\0';
-			log_col = 0;
-			log_row = (log_row + 1) % LOG_MAX;
-			if (log_row == log_top) log_top = (log_top + 1) % LOG_MAX;
-		}
-		if ((*ptr != '\n') && (*ptr != '\r')) {
-			log[log_row][log_col] = *ptr;
-			log_col++;
+
+	pos = log_ring_tail;
+	for (;;) {
+		slot = pos % LOG_RING;
+		lap = pos / LOG_RING;
+		state = log_ring[slot].state;
+		if (state == 2 * lap) {
+			if (__sync_bool_compare_and_swap(&log_ring_tail, pos, pos + 1))
+				break;
+		} else if ((int)(state - 2 * lap) < 0) {
+			/* the renderer has not drained the previous lap */
+			__sync_fetch_and_add(&log_ring_lost, 1);
+			return;
 		}
+		pos = log_ring_tail;
 	}
-	log[log_row][log_col] = '\0';
-	update_screen_locked();
-	pthread_mutex_unlock(&gUpdateMutex);
+
+	memcpy(log_ring[slot].text, buf, LOG_LINE);
+	__sync_synchronize();
+	log_ring[slot].state = 2 * lap + 1;
+	wake_renderer();
 }
 
 void ui_msg(int type, int align, const char *fmt, ...)
@@ -494,6 +1009,7 @@ void ui_msg(int type, int align, const char *fmt, ...)
 	vsnprintf(buf, 256, fmt, ap);
 	va_end(ap);
 
+	pthread_mutex_lock(&gUpdateMutex);
 	switch (align) {
 	  case MIDDLE:
 		msg[0][0] = '\0';
@@ -522,8 +1038,7 @@ void ui_msg(int type, int align, const char *fmt, ...)
 	}
 
 	msg[0][MAX_COLS-1] = '\0';
-	pthread_mutex_lock(&gUpdateMutex);
-	update_screen_locked();
+	mark_block_locked(MSG);
 	pthread_mutex_unlock(&gUpdateMutex);
 }
 
@@ -532,16 +1047,19 @@ void ui_start_menu(char** items, int initial_selection)
 	int k=0;
 
 	while (k < MENU_MAX && items[k] != NULL) ++k;
+	pthread_mutex_lock(&gUpdateMutex);
 	menu_items = k;
 	menu_sel = initial_selection;
 	set_block_text(MENU, items);
 	set_block_clr(MENU, menu_dclr);
 	menu_clr[menu_sel] = menu_sclr;
-	update_block(MENU, VISIBLE);
+	update_block_locked(MENU, VISIBLE);
+	pthread_mutex_unlock(&gUpdateMutex);
 }
 
 int ui_menu_select(int sel)
 {
+	struct key_trace trace;
 	int old_sel;
 
 	if (UI_BLOCK[MENU].show == VISIBLE) {
@@ -551,9 +1069,23 @@ int ui_menu_select(int sel)
 		if (menu_sel >= menu_items) menu_sel = menu_items-1;
 		sel = menu_sel;
 		if (menu_sel != old_sel){
-			set_block_clr(MENU, menu_dclr);
+			/* trace the key that moved the selection, once */
+			pthread_mutex_lock(&key_queue_mutex);
+			trace = gKeyTrace;
+			gKeyTrace.dequeued = 0;
+			pthread_mutex_unlock(&key_queue_mutex);
+
+			pthread_mutex_lock(&gUpdateMutex);
+			menu_clr[old_sel] = menu_dclr;
 			menu_clr[menu_sel] = menu_sclr;
-			update_block(MENU, VISIBLE);
+			mark_rows_locked(MENU_TOP + old_sel, 1);
+			mark_rows_locked(MENU_TOP + menu_sel, 1);
+			if (trace.dequeued) {
+				trace.marked = now_us();
+				gTracePending = trace;
+				gTraceWaiting = 1;
+			}
+			pthread_mutex_unlock(&gUpdateMutex);
 		}
 	}
 	return sel;
@@ -562,12 +1094,13 @@ int ui_menu_select(int sel)
 int ui_wait_key()
 {
 	pthread_mutex_lock(&key_queue_mutex);
-	while (key_queue_len == 0) {
+	while (key_queue_head == key_queue_tail) {
 		pthread_cond_wait(&key_queue_cond, &key_queue_mutex);
 	}
 
-	int key = key_queue[0];
-	memcpy(&key_queue[0], &key_queue[1], sizeof(int) * --key_queue_len);
+	gKeyTrace = key_queue[key_queue_head++ % KEY_QUEUE];
+	gKeyTrace.dequeued = now_us();
+	int key = gKeyTrace.code;
 	pthread_mutex_unlock(&key_queue_mutex);
 	return key;
 }
@@ -581,14 +1114,63 @@ int ui_key_pressed(int key)
 void ui_clear_key_queue()
 {
 	pthread_mutex_lock(&key_queue_mutex);
-	key_queue_len = 0;
+	key_queue_head = key_queue_tail;
 	pthread_mutex_unlock(&key_queue_mutex);
 }
 
+void ui_latency_overlay(int on)
+{
+	pthread_mutex_lock(&gUpdateMutex);
+	gLatencyOverlay = on;
+	mark_rows_locked(LATENCY_ROW, 1);
+	pthread_mutex_unlock(&gUpdateMutex);
+}
+
+void ui_latency_each(void (*fn)(const char *line, void *data), void *data)
+{
+	unsigned hist[LATENCY_BUCKETS];
+	char line[MAX_COLS];
+	int i;
+
+	pthread_mutex_lock(&gUpdateMutex);
+	memcpy(hist, latency_hist, sizeof(hist));
+	latency_summary_locked(line, sizeof(line));
+	pthread_mutex_unlock(&gUpdateMutex);
+
+	fn(line, data);
+	for (i = 0; i < LATENCY_BUCKETS; i++) {
+		if (i < LATENCY_BUCKETS - 1)
+			snprintf(line, sizeof(line), "<%dms: %u",
+				 latency_bounds[i], hist[i]);
+		else
+			snprintf(line, sizeof(line), ">=%dms: %u",
+				 latency_bounds[i - 1], hist[i]);
+		fn(line, data);
+	}
+}
+
+
+/* the input event time on CLOCK_MONOTONIC. evdev stamps events with
+   CLOCK_REALTIME, so go by their age, and trust no age over a second
+   in case the wall clock was set in between. */
+static long long input_time_us(const struct input_event *ev, long long now)
+{
+	struct timespec ts;
+	long long age;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	age = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000 -
+	      (ev->time.tv_sec * 1000000LL + ev->time.tv_usec);
+	if (age < 0 || age > 1000000LL)
+		age = 0;
+	return now - age;
+}
 
 static int input_callback(int fd, short revents, void *data)
 {
+	struct key_trace *t;
 	struct input_event ev;
+	long long now;
 	int ret;
 
 	ret = ev_get_input(fd, revents, &ev);
@@ -599,10 +1181,14 @@ static int input_callback(int fd, short revents, void *data)
 		return 0;
 	key_pressed[ev.code] = ev.value;
 
+	now = now_us();
 	pthread_mutex_lock(&key_queue_mutex);
-	const int queue_max = sizeof(key_queue) / sizeof(key_queue[0]);
-	if (ev.value > 0 && key_queue_len < queue_max) {
-		key_queue[key_queue_len++] = ev.code;
+	if (ev.value > 0 && key_queue_tail - key_queue_head < KEY_QUEUE) {
+		t = &key_queue[key_queue_tail++ % KEY_QUEUE];
+		memset(t, 0, sizeof(*t));
+		t->code = ev.code;
+		t->input = input_time_us(&ev, now);
+		t->queued = now;
 		pthread_cond_signal(&key_queue_cond);
 	}
 	pthread_mutex_unlock(&key_queue_mutex);
@@ -633,14 +1219,15 @@ void ui_init(void)
 
 	fb_width = gr_fb_width();
 	fb_height = gr_fb_height();
-	printf("fb_width = %d, fb_height= %d\n", fb_width, fb_height);
+	probe_pixel_size();
+	printf("fb_width = %d, fb_height= %d, %d bytes per pixel\n",
+	       fb_width, fb_height, fb_pixel_size);
 	log_row = log_col = 0;
 	log_top = 1;
 
 	acquire_wake_lock(1, "fastboot");
 	gScreenSaverTimer = ui_alloc_timer(screen_saver_timer_cb, 1, NULL);
 	ui_start_timer(gScreenSaverTimer, default_screensaver_delay);
-	gBrightnessTimer = ui_alloc_timer(set_back_brightness_timer, 1, NULL);
 	gProgressTimer = ui_alloc_timer(progress_timer_cb, 1, NULL);
 
 	int i;
@@ -656,8 +1243,16 @@ void ui_init(void)
 		}
 	}
 	pthread_t t;
+	/* one pass for whatever was printed before */
+	gRenderWake = 1;
+	sem_init(&gRenderSem, 0, 1);
+	pthread_create(&t, NULL, render_thread, NULL);
 	pthread_create(&t, NULL, input_thread, NULL);
 	pthread_create(&t, NULL, screen_state_thread, NULL);
+	if (backlight_open() == 0)
+		pthread_create(&t, NULL, backlight_thread, NULL);
+	else
+		printf("No backlight in %s\n", SYSFS_BACKLIGHT);
 }
 
 void ui_exit(void)
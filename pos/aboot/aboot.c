@@ -40,6 +40,8 @@
 #include <sys/reboot.h>
 #include <sys/wait.h>
 #include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -51,6 +53,7 @@
 #include "debug.h"
 #include "device.h"
 #include "fastboot.h"
+#include "spawn.h"
 
 
 #include "ota.h"
@@ -83,7 +86,7 @@
 
 #define BOOT_DEVICE CMD_BOOT_DEV_SDCARD
 
-#define SYSTEM_BUF_SIZ     512    /* For system() and popen() calls. */
+#define SYSTEM_BUF_SIZ     512    /* For command line arguments. */
 #define CONSOLE_BUF_SIZ    400    /* For writes to /dev/console and friends */
 #define PARTITION_NAME_SIZ 100    /* Partition names (/mnt/boot) */
 #define DEVICE_NAME_SIZ    64     /* Device names (/dev/mmcblk0p1) */
@@ -164,7 +167,7 @@ struct ptable {
 #define device_format_string_sd2   "/dev/mmcblk2p%d"
 #define device_format_string_nand "/dev/nda%d"
 #define device_format_string_usb  "/dev/sda%d"
-#define device_format_string_nfs  "-o nolock 50.0.0.1:/android/nfs%d"
+#define device_format_string_nfs  "50.0.0.1:/android/nfs%d"
 
 struct ptable PartTable[] =
 {
@@ -230,92 +233,77 @@ struct ptable PartTable[] =
 #define MAX_SIZE_OF_SCRATCH (256*1024*1024)
 static void *scratch = NULL;
 
-int enable_rndis()
-{
-	char cmd[128];
-	int ret;
+#define RNDIS_ENABLE_FILE   "/sys/class/usb_composite/rndis/enable"
+#define RNDIS_NETDEV        "/sys/class/net/usb0"
+#define RNDIS_TIMEOUT_MS    3000
 
-	/*  the function mount( ) can't support NFS mount, workaround it by system( ) */
-	sprintf(cmd, "echo 1 > /sys/class/usb_composite/rndis/enable;sleep 3");
-	dprintf(INFO, "%s\n", cmd);
-	ret = system(cmd);
-	if (ret < 0) {
-		write_to_user("Unable to enable rndis: %s\n", strerror(errno));
+static int set_rndis(int enable)
+{
+	dprintf(INFO, "%s rndis\n", enable ? "enable" : "disable");
+	if (sysfs_write(RNDIS_ENABLE_FILE, enable ? "1" : "0")) {
+		write_to_user("Unable to %s rndis: %s\n",
+			      enable ? "enable" : "disable", strerror(errno));
 		return -1;
 	}
 
+	/* the gadget is ready once its network interface comes or goes */
+	if (sysfs_wait_path(RNDIS_NETDEV, enable, RNDIS_TIMEOUT_MS))
+		write_to_user("rndis: %s still %s after %d ms\n", RNDIS_NETDEV,
+			      enable ? "missing" : "present", RNDIS_TIMEOUT_MS);
+
 	return 0;
 }
 
+int enable_rndis()
+{
+	return set_rndis(1);
+}
+
 int disable_rndis()
 {
-	char cmd[128];
-	int ret;
+	return set_rndis(0);
+}
 
-	/*  the function mount( ) can't support NFS mount, workaround it by system( ) */
-	sprintf(cmd, "echo 0 > /sys/class/usb_composite/rndis/enable;sleep 3");
-	dprintf(INFO, "%s\n", cmd);
-	ret = system(cmd);
-	if (ret < 0) {
-		write_to_user("Unable to enable rndis: %s\n", strerror(errno));
-		return -1;
-	}
+/* fastboot INFO responses carry at most 60 bytes of text */
+#define INFO_PAYLOAD_SIZ   60
 
-	return 0;
+static void fastboot_info_output(const char *buf, int len, void *data)
+{
+	char line[INFO_PAYLOAD_SIZ + 1];
+	int n;
+
+	while (len > 0) {
+		n = len > INFO_PAYLOAD_SIZ ? INFO_PAYLOAD_SIZ : len;
+		memcpy(line, buf, n);
+		line[n] = '\0';
+		fastboot_info(line);
+		buf += n;
+		len -= n;
+	}
 }
 
 /*
- * function to execute a system command and return all output
+ * function to execute a command and return all output
  * back over the fastboot pipe.
  */
-int logged_system(const char * cmd)
+int logged_spawn(char *const argv[])
 {
-	char buf[65];
-	int len, ret, status;
-	pid_t pid;
-	int pipe_fd[2];
-
-	write_to_user("start : %s\n", cmd);
-	memset(buf, 0, sizeof(buf));
+	struct spawn_opts opts;
+	struct spawn_result res;
+	char cmdline[256];
+	int ret;
 
+	spawn_cmdline(argv, cmdline, sizeof(cmdline));
+	write_to_user("start : %s\n", cmdline);
+	memset(&opts, 0, sizeof(opts));
 	if (log_enable) {
-		fastboot_info(cmd);
-		if (pipe(pipe_fd) < 0) {
-			printf("Pipe create error\n");
-			return -1;
-		}
-		if ((pid = fork()) == 0) {
-			close(pipe_fd[0]);
-			close(STDOUT_FILENO);
-			close(STDERR_FILENO);
-			dup2(pipe_fd[1], STDOUT_FILENO);
-			dup2(pipe_fd[1], STDERR_FILENO);
-			status = system(cmd);
-			close(pipe_fd[1]);
-			exit(status);
-		}
-		else if (pid > 0) {
-			close(pipe_fd[1]);
-			waitpid(pid, &status, 0);
-			if (WIFEXITED(status)) {
-				ret = WEXITSTATUS(status);
-				while (0 < (len = read(pipe_fd[0], buf, 60))) {
-					fastboot_info(buf);
-					memset(buf, 0, sizeof(buf));
-				}
-			} else ret = -1;
-			close(pipe_fd[0]);
-			write_to_user("%s\n returns %d", cmd, ret);
-			return ret;
-		} else {
-			printf("The return PID is error\n");
-			return -1;
-		}
-	} else {
-		ret = system(cmd);
-		write_to_user("%s\n returns %d", cmd, ret);
-		return ret;
+		fastboot_info_output(cmdline, strlen(cmdline), NULL);
+		opts.output = fastboot_info_output;
 	}
+
+	ret = spawn_run(argv, &opts, &res);
+	write_to_user("%s\n returns %d (%ld ms)", cmdline, ret, res.elapsed_ms);
+	return ret;
 }
 
 
@@ -379,13 +367,11 @@ int mount_partition(int ptn)
         dprintf(INFO, "%s: %s (name:%s type: %s)\n", __FUNCTION__, devName, PartTable[i].name, fsType);
         snprintf(buf, sizeof(buf), "/mnt/%s", PartTable[i].name);
 	if (!strcmp(fsType, "nfs")) {
-		char cmd[128];
+		char *const cmd[] = { "mount", "-t", fsType, "-o", "nolock",
+			devName, buf, NULL };
 		int ret;
-		/*  the function mount( ) can't support NFS mount, workaround it by system( ) */
-		sprintf(cmd, "mount -t %s " device_format_string_nfs " %s", fsType,
-				PartTable[i].devNum, buf);
-		dprintf(INFO, "%s\n", cmd);
-		ret = logged_system(cmd);
+		/*  the function mount( ) can't support NFS mount, workaround it by mount(8) */
+		ret = logged_spawn(cmd);
 		if (ret < 0) {
 			dprintf(INFO, "Unable to mount partition: %s\n", strerror(errno));
 			return 1;
@@ -482,13 +468,16 @@ autoboot_is_disabled(void)
 int kexec_linux(char *root, char *kernel, char *initrd, char *cmdline)
 {
         char buf[SYSTEM_BUF_SIZ], buf2[SYSTEM_BUF_SIZ], *sp;
+        char ramdisk[SYSTEM_BUF_SIZ], command_line[SYSTEM_BUF_SIZ + 16];
+        char *const cmd[] = { "kexec", "-f", "-x", buf, ramdisk,
+                command_line, NULL };
         const char *bootmedia;
         int fd;
 
         sprintf(buf2, "%s/%s", root, cmdline);
         fd = open(buf2, O_RDONLY);
         if (fd < 0) {
-            write_to_user("ERROR: unable to open %s (%s).\n", strerror(errno));
+            write_to_user("ERROR: unable to open %s (%s).\n", buf2, strerror(errno));
             return 1;
         }
         if (read(fd, buf2, sizeof(buf2)-1) <= 0) {
@@ -507,13 +496,13 @@ int kexec_linux(char *root, char *kernel, char *initrd, char *cmdline)
             bootmedia = "harddisk";
         strcat(buf2, bootmedia);
 
-        snprintf(buf, sizeof(buf),
-            "kexec -f -x %s%s --ramdisk=%s%s --command-line=\"%s\"\n",
-            root, kernel, root, initrd, buf2);
+        snprintf(buf, sizeof(buf), "%s%s", root, kernel);
+        snprintf(ramdisk, sizeof(ramdisk), "--ramdisk=%s%s", root, initrd);
+        snprintf(command_line, sizeof(command_line), "--command-line=%s", buf2);
         close(fd);
 
-        dprintf(INFO, "%s: %s\n", __FUNCTION__, buf);
-        if (logged_system(buf) < 0) {
+        dprintf(INFO, "%s: %s %s %s\n", __FUNCTION__, buf, ramdisk, command_line);
+        if (logged_spawn(cmd) < 0) {
                 perror(__FUNCTION__);
                 return 1;
         }
@@ -669,10 +658,58 @@ void cmd_boot(const char *arg, void *data, unsigned sz)
         // we don't return from here.
 }
 
+/* remove everything below dir_path, in process. returns 0 or 1 if
+   anything could not be removed. */
+static int empty_dir(const char *dir_path)
+{
+        char path[PATH_MAX];
+        struct dirent *de;
+        struct stat st;
+        DIR *dir;
+        int ret = 0;
+
+        if ((dir = opendir(dir_path)) == NULL)
+                return 1;
+        while ((de = readdir(dir)) != NULL) {
+                if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+                        continue;
+                snprintf(path, sizeof(path), "%s/%s", dir_path, de->d_name);
+                if (lstat(path, &st) < 0) {
+                        ret = 1;
+                } else if (S_ISDIR(st.st_mode)) {
+                        if (empty_dir(path) || rmdir(path) < 0)
+                                ret = 1;
+                } else if (unlink(path) < 0) {
+                        ret = 1;
+                }
+        }
+        closedir(dir);
+        return ret;
+}
+
+/* empty an NFS export: mount it on /mnt and remove everything below */
+static int wipe_nfs_export(char *export)
+{
+        char *const mount_cmd[] = { "mount", "-t", "nfs", "-o", "nolock",
+                export, "/mnt", NULL };
+        int ret;
+
+        if (logged_spawn(mount_cmd) != 0)
+                return 1;
+
+        ret = empty_dir("/mnt");
+        if (ret)
+                dprintf(INFO, "%s: could not empty %s\n", __FUNCTION__, export);
+        if (umount("/mnt") < 0)
+                ret = 1;
+        return ret;
+}
+
 static int format_partition(int ptn_id)
 {
         char devName[DEVICE_NAME_SIZ];
-        char buf[SYSTEM_BUF_SIZ];
+        char mkfs[DEVICE_NAME_SIZ];
+        char *cmd[] = { mkfs, "-L", PartTable[ptn_id].name, devName, NULL };
         char boot_device[DEVICE_NAME_SIZ];
 	char *fsType;
         dprintf(SPEW, "formatting partition %d: %s\n", ptn_id, PartTable[ptn_id].name);
@@ -698,20 +735,15 @@ static int format_partition(int ptn_id)
  		fsType = "nfs";
         }
 
-        if (!strcmp(fsType, "ext3"))
-                snprintf(buf, sizeof(buf),"mkfs.%s -L %s %s",
-                         fsType, PartTable[ptn_id].name, devName);
-        else if (!strcmp(fsType, "ext4"))
-                snprintf(buf, sizeof(buf),"mkfs.%s -L %s %s",
-                         fsType, PartTable[ptn_id].name, devName);
- 	else if (!strcmp(fsType, "nfs"))
-                 snprintf(buf, sizeof(buf),"mount -t %s %s /mnt && rm -fr /mnt/* && umount /mnt",
-                         fsType, devName);
-        else
-                snprintf(buf, sizeof(buf),"mkfs.%s -i %s %s",
-                        PartTable[ptn_id].fsType, PartTable[ptn_id].name, devName);
-        dprintf(INFO, "%s: %s\n", __FUNCTION__, buf);
-        if (logged_system(buf) != 0) {
+        if (!strcmp(fsType, "nfs"))
+                return wipe_nfs_export(devName);
+
+        snprintf(mkfs, sizeof(mkfs), "mkfs.%s", fsType);
+        if (strcmp(fsType, "ext3") && strcmp(fsType, "ext4"))
+                cmd[1] = "-i";
+        dprintf(INFO, "%s: %s %s %s %s\n", __FUNCTION__, mkfs, cmd[1],
+                PartTable[ptn_id].name, devName);
+        if (logged_spawn(cmd) != 0) {
                 perror(__FUNCTION__);
                 return 1;
         }
@@ -819,35 +851,44 @@ void cmd_flash(const char *arg, void *data, unsigned sz)
         if (file) {
                 /* update individual file */
                 snprintf(buf, sizeof(buf), "%s/%s", mnt_point, file);
+                dprintf(INFO, "%s: %s\n", __FUNCTION__, buf);
                 fp = fopen(buf, "w+");
+                if (fp == NULL) {
+                        perror("fopen");
+                        fastboot_fail("fail to open file");
+                        return;
+                }
+                if (sz != fwrite(data, 1, sz,fp)) {
+                        perror("fwrite");
+                        fastboot_fail("flash write failure");
+                        fclose(fp);
+                        return;
+                }
+                fclose(fp);
         } else {
                 int origin_is_mntpoint =
                         (strcmp(fastboot_getvar(CMD_ORIGIN), CMD_ORIGIN_MNT) == 0);
-                /* update the whole partition */
-                snprintf(buf, sizeof(buf), "tar xzf - -C %s",
-                        origin_is_mntpoint ? mnt_point: "/mnt");
-                fp = popen(buf, "w");
-        }
-
-        dprintf(INFO, "%s: %s\n", __FUNCTION__, buf);
-        if (fp == NULL) {
-                perror("popen or fopen");
-                fastboot_fail("fail to open pipe or file");
-                return;
-        }
-        if (sz != fwrite(data, 1, sz,fp)) {
-                perror("fwrite");
-                fastboot_fail("flash write failure");
-                pclose(fp);
-                return;
+                char *const tar[] = { "tar", "xzf", "-", "-C",
+                        origin_is_mntpoint ? mnt_point : "/mnt", NULL };
+                struct spawn_opts opts;
+
+                /* update the whole partition, the image is fed to tar's stdin */
+                dprintf(INFO, "%s: tar xzf - -C %s\n", __FUNCTION__, tar[4]);
+                memset(&opts, 0, sizeof(opts));
+                opts.input = data;
+                opts.input_len = sz;
+                if (spawn_run(tar, &opts, NULL) != 0) {
+                        fastboot_fail("flash write failure");
+                        return;
+                }
         }
         dprintf(INFO, "wrote %d bytes to '%s'\n", sz, arg);
-        pclose(fp);
 
 	if (strcmp(arg, "boot") == 0) {
-		snprintf(buf, sizeof(buf),
-			"flash_stitched %s", BOOT_IMAGE_FILE);
-		logged_system( buf );
+		char *const flash_stitched[] = { "flash_stitched",
+			BOOT_IMAGE_FILE, NULL };
+
+		logged_spawn(flash_stitched);
 		fastboot_okay("");
 		return;
 	}
@@ -881,7 +922,10 @@ void cmd_oem(const char *arg, void *data, unsigned sz)
                 arg += strlen(CMD_SYSTEM);
                 while (*arg == ' ')
                         arg++;
-                if (logged_system(arg) != 0) {
+                /* the host sends a shell command line, so a shell is wanted here */
+                char *const sh[] = { "sh", "-c", (char *)arg, NULL };
+
+                if (logged_spawn(sh) != 0) {
                         write_to_user("\nfails: %s\n", arg);
                         fastboot_fail("OEM system command failed");
                 } else {
@@ -52,80 +52,39 @@
 
 #include <linux/netlink.h>
 #include <linux/reboot.h>
-#include <sys/msg.h>
 
 #include "recovery.h"
+#include "power_supply.h"
+#include "uevent.h"
+#include "event_ring.h"
+#include "backlight.h"
 
-#define SYSFS_POWER_SUPPLY_INT  "/sys/class/power_supply"
-#define BRIGHT_ON               "60"
-#define BRIGHT_OFF              "0"
+#define BRIGHT_ON               60
+#define BRIGHT_OFF              0
 
-typedef enum {
-	POWER_SUPPLY_STATUS_UNKNOWN,
-	POWER_SUPPLY_STATUS_CHARGING,
-	POWER_SUPPLY_STATUS_DISCHARGING,
-	POWER_SUPPLY_STATUS_NOT_CHARGING,
-	POWER_SUPPLY_STATUS_FULL,
-	POWER_SUPPLY_STATUS_COUNT,
-} POWER_SUPPLY_STATUS;
-
-/* Extract from Kernel's power_supply_sysfs.c */
-static char *status_text[] = {
-	"Unknown", "Charging", "Discharging", "Not charging", "Full"
-};
-
-struct power_supply_status
-{
-	char path[255];
-	int present;
-	int voltage_now;
-	int current_now;
-	int capacity;
-	int temp;
-	int charge_now;
-	int charge_full;
-	int charge_full_design;
-	POWER_SUPPLY_STATUS charging_status;
-};
-
-static struct msgtype {
-	long mtype;
-	char buffer[100];
-} msg;
-
-static struct power_supply_status charger;
-static struct power_supply_status battery;
+static struct power_supply charger;
+static struct power_supply battery;
 static int power_low = 0;
-static int msgID;
+static struct event_ring *ring;
 
-extern int event_init(void);
+extern int event_init(__u16 type, __u16 code);
 extern int event_wait(struct input_event *ev, unsigned dont_wait, __u16 type,
 		__u16 code, __s32 value);
-extern char *get_brightness_path(void);
-extern int get_back_brightness(void);
 
 int is_power_low(void)
 {
 	return power_low;
 }
 
-static void set_back_brightness()
+/* SIGALRM handler, the screen timed out. event_ring_post() takes a
+   lock, only the signal safe notify may be used here. */
+static void screen_timeout(int sig)
 {
-	char *str;
-	FILE *file;
-	char *bright;
-
-	if (get_back_brightness())
-		bright = BRIGHT_OFF;
-	else
-		bright = BRIGHT_ON;
+	int err = errno;
 
-	str = get_brightness_path();
-
-	if ((file = fopen(str, "w+")) != NULL) {
-		fwrite(bright, (strlen(bright) + 1), 1, file);
-		fclose(file);
-	}
+	backlight_set(BRIGHT_OFF);
+	event_ring_notify(ring, EVENT_SCREEN, 0);
+	errno = err;
 }
 
 static void *powerbtn_event(void *arg)
@@ -133,167 +92,61 @@ static void *powerbtn_event(void *arg)
 	int bright_val = 0;
 	struct input_event ev;
 
-	event_init();
-	signal(SIGALRM, set_back_brightness);
+	event_init(EV_KEY, KEY_POWER);
+	if (backlight_open() < 0)
+		syslog(LOG_ERR, "no backlight in %s\n", SYSFS_BACKLIGHT);
+	signal(SIGALRM, screen_timeout);
 	alarm(5);
 
 	do {
 		event_wait(&ev, 0, EV_KEY, KEY_POWER, 1);
 
-		bright_val = get_back_brightness();
+		bright_val = backlight_get();
 		if (bright_val < 0)
 			continue;
 
 		if (bright_val == 0) {
-			set_back_brightness();
-			signal(SIGALRM, set_back_brightness);
+			backlight_set(BRIGHT_ON);
+			event_ring_post(ring, EVENT_SCREEN, 1);
+			signal(SIGALRM, screen_timeout);
 			alarm(5);
 		} else {
 			alarm(0);
-			set_back_brightness();
+			backlight_set(BRIGHT_OFF);
+			event_ring_post(ring, EVENT_SCREEN, 0);
 		}
 	} while (1);
 
 	return NULL;
 }
 
-static int readFromFile(const char *path, char *buf, size_t size)
+/* returns the PS_* mask of changed fields, -1 on error */
+int get_power_supply_status(struct power_supply *ps)
 {
-	if (!path)
-		return -1;
-	int fd = open(path, O_RDONLY, 0);
-	if (fd == -1) {
-		syslog(LOG_ERR, "Could not open '%s'", path);
-		return -1;
-	}
-	size_t count = read(fd, buf, size);
-	if (count > 0) {
-		count = (count < size) ? count : size - 1;
-		while (count > 0 && buf[count - 1] == '\n')
-			count--;
-		buf[count] = '\0';
-	} else {
-		buf[0] = '\0';
-	}
-	close(fd);
-	return count;
-}
+	int changed = power_supply_read(ps);
 
-/* find a power_supply that is of given type in sysfs
-   retry for 4 sec until found.
- */
-int find_power_supply(struct power_supply_status *st, char *type)
-{
-	DIR *pDir;
-	struct dirent *ent = NULL;
-	char path[255], buf[255];
-	int i;
-	for (i = 0; i < 40; i++) {
-		pDir = opendir(SYSFS_POWER_SUPPLY_INT);
-		while ((ent = readdir(pDir)) != NULL) {
-			snprintf(path, 255, SYSFS_POWER_SUPPLY_INT"/%s/type", ent->d_name);
-			if (readFromFile(path, buf, 255)>0 &&
-			    strstr(buf, type) != NULL) {
-				snprintf(st->path, 255, SYSFS_POWER_SUPPLY_INT"/%s/uevent", ent->d_name);
-				return 0;
-			}
-			syslog(LOG_INFO, "non matching power_supply %s != %s\n", buf, type);
-		}
-		usleep(100000);
-	}
-	syslog(LOG_ERR, "did not find power_supply %s\n", type);
-	return -ENOENT;
-}
-
-void try_read_property(char *src, char *prop_name, int *value)
-{
-	char *res = strstr(src, prop_name);
-	if (res) {
-		/*skip prop_name and '='*/
-		res += strlen(prop_name) + 1;
-		*value = atoi(res);
-	}
-}
-
-int get_power_supply_status(struct power_supply_status *status)
-{
-	FILE *f = fopen(status->path, "r");
-	char buf[256];
-	char *res = NULL;
-	int i = 0;
-
-	if(f == NULL) {
-		syslog(LOG_ERR, "unable to open status file\n");
-		return -1;
-	}
-
-	while(fgets(buf, 256, f)) {
-		try_read_property(buf, "PRESENT", &status->present);
-		try_read_property(buf, "VOLTAGE_NOW", &status->voltage_now);
-		try_read_property(buf, "CURRENT_NOW", &status->current_now);
-		try_read_property(buf, "CAPACITY", &status->capacity);
-		try_read_property(buf, "TEMP", &status->temp);
-		try_read_property(buf, "CHARGE_NOW", &status->charge_now);
-		try_read_property(buf, "CHARGE_FULL", &status->charge_full);
-		try_read_property(buf, "CHARGE_FULL_DESIGN", &status->charge_full_design);
-
-		res = strstr(buf, "STATUS");
-                if (res) {
-			status->charging_status = POWER_SUPPLY_STATUS_UNKNOWN;
-			res += strlen("STATUS") + 1;
-			for (i = 0; i < POWER_SUPPLY_STATUS_COUNT; i++) {
-				if (strncmp(res, status_text[i], strlen(status_text[i])) == 0)
-				{
-					status->charging_status = i;
-					break;
-				}
-			}
-			if (i >= POWER_SUPPLY_STATUS_COUNT) {
-				syslog(LOG_ERR, "Abnormal status: '%s'\n", res);
-			}
-		}
-	}
-	fclose(f);
-	return 0;
+	if (changed < 0)
+		syslog(LOG_ERR, "unable to read %s\n", ps->path);
+	return changed;
 }
 
 /* Get the IA_APPS_RUN in uV from the SMIP */
 static int get_voltage_gate()
 {
-	int devfd, errNo;
-	unsigned int read_buf;
-	unsigned int voltage_gate, ret=0;
-
-	if ((devfd = open(IPC_DEVICE_NAME, O_RDWR)) < 0) {
-		syslog(LOG_ERR, "unable to open the DEVICE %s\n",
-			IPC_DEVICE_NAME);
-		ret = 0;
-		goto err1;
-	}
+	unsigned int voltage_gate;
 
-	if ((errNo = ioctl(devfd, IPC_READ_VBATTCRIT, &read_buf)) < 0) {
-		syslog(LOG_ERR, "ioctl for DEVICE %s, returns error-%d\n",
-			IPC_DEVICE_NAME, errNo);
-		ret = 0;
-		goto err2;
+	if (scu_ipc_voltage_gate(&voltage_gate) < 0) {
+		syslog(LOG_ERR, "unable to read VBATTCRIT from %s: %s\n",
+			IPC_DEVICE_NAME, strerror(errno));
+		return 0;
 	}
-
-	/*The VBATTCRIT value is the 2nd 2-bytes of this 4-bytes */
-	voltage_gate = read_buf >> 16;
-	/* Change mV to uV to align with the current voltage read from sysfs interface */
-	ret = voltage_gate * 1000;
-err2:
-	close(devfd);
-err1:
-	return ret;
+	return voltage_gate;
 }
 
 static void *power_supply_event(void *arg)
 {
-	struct sockaddr_nl nls;
-	struct pollfd pfd;
-	char buf[512];
-	int voltage_gate;
+	struct uevent_listener ul;
+	int voltage_gate, changed;
 
 	syslog(LOG_DEBUG, "power_supply_event thread created ...\n");
 	if ((voltage_gate = get_voltage_gate()) < 0) {
@@ -301,100 +154,76 @@ static void *power_supply_event(void *arg)
 		return NULL;
 	}
 
-	memset(&nls, 0, sizeof(struct sockaddr_nl));
-	nls.nl_family = AF_NETLINK;
-	nls.nl_pid = getpid();
-	nls.nl_groups = -1;
-
-	pfd.events = POLLIN;
-	pfd.fd = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT);
-
-	if (bind(pfd.fd, (void *)&nls, sizeof(struct sockaddr_nl))) {
+	if (uevent_open(&ul, "power_supply")) {
 		syslog(LOG_ERR, "Bind failed\n");
 		return NULL;
 	}
+	get_power_supply_status(&charger);
 	get_power_supply_status(&battery);
-	msg.mtype = BAT_STATUS;
-	sprintf(msg.buffer,"%d", battery.capacity);
-	msgsnd(msgID, &msg, sizeof(struct msgtype), 0);
-
-	while (-1 != poll(&pfd, 1, -1)) {
-		int i, len = recv(pfd.fd, buf, sizeof(buf), MSG_DONTWAIT);
-		if (len == -1) {
-			syslog(LOG_ERR, "receive failed \n");
-			break;
+	event_ring_post(ring, EVENT_CHARGER, charger.st.present != 0);
+	event_ring_post(ring, EVENT_BATTERY, battery.st.capacity);
+
+	/* a charger plug-in fires a burst of events, refresh once per burst */
+	while (uevent_wait(&ul, -1, UEVENT_DEBOUNCE_MS) >= 0) {
+		changed = get_power_supply_status(&charger);
+		changed |= get_power_supply_status(&battery);
+		/* the same values again, skip the log and the UI messages */
+		if (changed == 0)
+			continue;
+		syslog(LOG_INFO, "\rcapacity = %d%% V= %.2fV->%.2fV I= %.2fmA T=%.1fC\n",
+			battery.st.capacity,
+			battery.st.voltage_now/1000000.,
+			voltage_gate/1000000.,
+			battery.st.current_now/1000.,
+			battery.st.temp/10.
+			);
+		/* the UI only wakes up when a value actually changes */
+		event_ring_post(ring, EVENT_CHARGER, charger.st.present != 0);
+
+		/* TODO: This will give repeated notices to user, but we should
+		alert user by the popup window, this GUI api was not completed. */
+		if (battery.st.capacity == 0 &&
+			(!charger.st.present || (battery.st.status != POWER_SUPPLY_STATUS_CHARGING))) {
+			/* Need to do the test again in 5sec */
+			printf("WARNING:Power too low, auto shutdown (1st attempt)\n");
+			syslog(LOG_WARNING, "WARNING:Power too low, auto shutdown (1st attempt)\n");
+			sleep(5);
+			get_power_supply_status(&battery);
+			if (battery.st.capacity == 0 &&
+				(!charger.st.present || (battery.st.status != POWER_SUPPLY_STATUS_CHARGING))) {
+				printf("WARNING:Power too low, auto shutdown (1st attempt)\n");
+				syslog(LOG_WARNING, "WARNING:Power too low, auto shutdown in 5sec!\n");
+				sleep(5);
+				reboot(LINUX_REBOOT_CMD_POWER_OFF);
+			}
+			continue;
+		} else if (battery.st.capacity <= 10 &&
+				(!charger.st.present || (battery.st.status != POWER_SUPPLY_STATUS_CHARGING))) {
+			printf("WARNING:Low power! please plug in the power.\n");
+			syslog(LOG_WARNING, "WARNING:Low power! please plug in the power.\n");
 		}
-		i = 0;
-		while (i < len) {
-			i += strlen(buf + i) + 1;
-			if (!strncmp(buf + i, "SUBSYSTEM=power_supply", strlen("SUBSYSTEM=power_supply"))) {
-				get_power_supply_status(&charger);
-				get_power_supply_status(&battery);
-				syslog(LOG_INFO, "\rcapacity = %d%% V= %.2fV->%.2fV I= %.2fmA T=%.1fC\n",
-					battery.capacity,
-					battery.voltage_now/1000000.,
-					voltage_gate/1000000.,
-					battery.current_now/1000.,
-					battery.temp/10.
-					);
-				if (charger.present == 0) {
-					msg.mtype = CHRG_EVENT;
-					strcpy(msg.buffer, CHRG_REMOVE);
-					msgsnd(msgID, &msg, sizeof(struct msgtype), 0);
-				} else {
-					msg.mtype = CHRG_EVENT;
-					strcpy(msg.buffer, CHRG_INSERT);
-					msgsnd(msgID, &msg, sizeof(struct msgtype), 0);
-				}
-
-				/* TODO: This will give repeated notices to user, but we should
-				alert user by the popup window, this GUI api was not completed. */
-				if (battery.capacity == 0 &&
-					(!charger.present || (battery.charging_status != POWER_SUPPLY_STATUS_CHARGING))) {
-					/* Need to do the test again in 5sec */
-					printf("WARNING:Power too low, auto shutdown (1st attempt)\n");
-					syslog(LOG_WARNING, "WARNING:Power too low, auto shutdown (1st attempt)\n");
-					sleep(5);
-					get_power_supply_status(&battery);
-					if (battery.capacity == 0 &&
-						(!charger.present || (battery.charging_status != POWER_SUPPLY_STATUS_CHARGING))) {
-						printf("WARNING:Power too low, auto shutdown (1st attempt)\n");
-						syslog(LOG_WARNING, "WARNING:Power too low, auto shutdown in 5sec!\n");
-						sleep(5);
-						reboot(LINUX_REBOOT_CMD_POWER_OFF);
-					}
-					break;
-				} else if (battery.capacity <= 10 &&
-						(!charger.present || (battery.charging_status != POWER_SUPPLY_STATUS_CHARGING))) {
-					printf("WARNING:Low power! please plug in the power.\n");
-					syslog(LOG_WARNING, "WARNING:Low power! please plug in the power.\n");
-				}
-				msg.mtype = BAT_STATUS;
-				sprintf(msg.buffer,"%d", battery.capacity);
-				msgsnd(msgID, &msg, sizeof(struct msgtype), 0);
-
-				if (battery.voltage_now < voltage_gate) {
-					power_low = 1;
-				} else {
-					power_low = 0;
-				}
+		event_ring_post(ring, EVENT_BATTERY, battery.st.capacity);
 
-				break;
-			}
+		if (battery.st.voltage_now < voltage_gate) {
+			power_low = 1;
+		} else {
+			power_low = 0;
 		}
 	}
+	syslog(LOG_ERR, "receive failed \n");
+	uevent_close(&ul);
 	return NULL;
 }
 
-int pos_event_main(int argc, char *argv[], int msgid)
+int pos_event_main(int argc, char *argv[], struct event_ring *r)
 {
 	int err;
 	pthread_t thr;
 	pthread_attr_t atr;
 
-	msgID = msgid;
-	err = find_power_supply(&battery, "Battery");
-	err |= find_power_supply(&charger, "USB");
+	ring = r;
+	err = power_supply_find(&battery, "Battery", POWER_SUPPLY_FIND_MS);
+	err |= power_supply_find(&charger, "USB", POWER_SUPPLY_FIND_MS);
 	if (err) {
 		syslog(LOG_ERR, "There are issues with battery or charger driver. shutting down\n");
 		sleep(5);
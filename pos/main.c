@@ -44,14 +44,13 @@
 #include <sys/ioctl.h>
 #include <linux/reboot.h>
 #include <sys/types.h>
-#include <sys/ipc.h>
-#include <sys/msg.h>
 #include <sys/stat.h>
 
 #include "ota.h"
+#include "event_ring.h"
 
-extern int pos_event_main(int argc, char *argv[], int msgid);
-extern int pos_ui(int argc, char *argv[], int fd, int msgid);
+extern int pos_event_main(int argc, char *argv[], struct event_ring *ring);
+extern int pos_ui(int argc, char *argv[], int fd, struct event_ring *ring);
 extern int aboot_main(int argc, char *argv[]);
 extern void write_to_user(char *fmt, ...);
 extern void cmd_reboot(const char *arg, void *data, unsigned sz);
@@ -60,13 +59,11 @@ int pos_main(int argc, char *argv[])
 {
 	int fd[2];
 	pid_t pid;
-	key_t key;
-	int msgid;
+	struct event_ring *ring;
 
-	key = getpid();
-	msgid = msgget(key, S_IRUSR | S_IWUSR | IPC_CREAT | IPC_EXCL);
-	if (msgid == -1) {
-		syslog(LOG_ERR, "msg create error\n");
+	ring = event_ring_create();
+	if (ring == NULL) {
+		syslog(LOG_ERR, "event ring create error\n");
 		return -1;
 	}
 
@@ -79,7 +76,7 @@ int pos_main(int argc, char *argv[])
 		close(STDOUT_FILENO);
 		dup2(fd[1], STDOUT_FILENO);
 
-		pos_event_main(argc, argv, msgid);
+		pos_event_main(argc, argv, ring);
 
 		if (ota_update() == INSTALL_SUCCESS) {
 			write_to_user
@@ -89,7 +86,7 @@ int pos_main(int argc, char *argv[])
 			aboot_main(argc, argv);
 	} else {
 		close(fd[1]);
-		pos_ui(argc, argv, fd[0], msgid);
+		pos_ui(argc, argv, fd[0], ring);
 	}
 	return 0;
 }
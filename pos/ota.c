@@ -42,6 +42,8 @@
 #include <dirent.h>
 
 #include "ota.h"
+#include "spawn.h"
+#include "scu_ipc.h"
 #include "debug.h"
 #include "fastboot.h"
 #include "ui.h"
@@ -62,8 +64,6 @@
 #define EMMC_SYS_ENTRY    "/sys/devices/pci0000:00/0000:00:01.0/mmc_host/mmc0"
 #define SDCARD_SYS_ENTRY  "/sys/devices/pci0000:00/0000:00:04.0/mmc_host/mmc1"
 
-#define IPC_WRITE_RR_TO_OSNIB	0xC2
-#define IPC_DEVICE_NAME		"/dev/mid_ipc"
 #define RR_SIGNED_MOS		0x0
 
 extern void write_to_user(char *, ...);
@@ -86,17 +86,31 @@ static const int MAX_ARGS = 100;
 static int mount_package(const char *);
 //static int umount_package(const char *);
 
-static int run_command(char *cmd)
+static int run_command(char *const argv[])
 {
-	int status = system(cmd);
-	int sys_status = WEXITSTATUS(status);
-
-	if (sys_status != 0)
-		write_to_user("system error message: %s\n",
-			      strerror(sys_status));
+	struct spawn_result res;
+	char cmdline[256];
+	int sys_status, err;
+
+	sys_status = spawn_run(argv, NULL, &res);
+	err = errno;
+	spawn_cmdline(argv, cmdline, sizeof(cmdline));
+	write_to_user("%s returns %d (%ld ms)\n", cmdline, sys_status,
+		      res.elapsed_ms);
+	/* a positive status is the tool's exit code, not an errno */
+	if (sys_status < 0) {
+		if (res.status == -1)
+			write_to_user("system error message: %s\n",
+				      strerror(err));
+		else if (WIFSIGNALED(res.status))
+			write_to_user("killed by signal %d\n",
+				      WTERMSIG(res.status));
+	}
 	return sys_status ? -1 : 0;
 }
 
+static char *const osip_restore_cmd[] = { "update_osip", "--restore", NULL };
+
 static void check_and_fclose(FILE * fp, const char *name)
 {
 	fflush(fp);
@@ -179,7 +193,7 @@ static int ota_finish(const int status)
 
 error:
 	umount_partition(DATA);
-	run_command("update_osip --restore");
+	run_command(osip_restore_cmd);
 	write_to_user("ota finished, rebooting...\n");
 
 	return 0;
@@ -188,7 +202,7 @@ error:
 static int device_wipe_data()
 {
 	cmd_erase("data", NULL, 0);
-	return (run_command("update_osip --restore") ? INSTALL_ERROR :
+	return (run_command(osip_restore_cmd) ? INSTALL_ERROR :
 		INSTALL_SUCCESS);
 }
 
@@ -209,28 +223,30 @@ static int add_ifwi_flag()
 
 static int update_ifwi()
 {
-	char cmd[512] = { '\0', };
+	char *const cp_ifwi[] = { "cp",
+		PACKAGE_PATH "/android/firmware/ifwi_firmware.bin", "-d", "/tmp/",
+		NULL };
+	char *const cp_dnx[] = { "cp",
+		PACKAGE_PATH "/android/firmware/dnx_firmware.bin", "-d", "/tmp/",
+		NULL };
+	char *const umount_sdcard[] = { "umount", "/mnt/sdcard", NULL };
+	char *const ifwi_update[] = { "ifwi-update",
+		"/tmp/dnx_firmware.bin", "/tmp/ifwi_firmware.bin", NULL };
 
 	/* step one: unzip ifwi.zip to ramdisk */
-	sprintf(cmd, "cp %s/android/firmware/ifwi_firmware.bin -d /tmp/",
-		PACKAGE_PATH);
-	if (run_command(cmd))
+	if (run_command(cp_ifwi))
 		goto oops;
-	sprintf(cmd, "cp %s/android/firmware/dnx_firmware.bin -d /tmp/",
-		PACKAGE_PATH);
-	if (run_command(cmd))
+	if (run_command(cp_dnx))
 		goto oops;
 	/* step two: umount package */
 	umount_package(PACKAGE_PATH);
 	/* step three: write flag. flag file had = updated, no flag file = haven't updated */
 	add_ifwi_flag();
 	/* step four: umount emmc */
-	if (run_command("umount /mnt/sdcard"))
+	if (run_command(umount_sdcard))
 		goto oops;
 	/* step five: update ifwi */
-	sprintf(cmd,
-		"ifwi-update /tmp/dnx_firmware.bin /tmp/ifwi_firmware.bin");
-	if (run_command(cmd))
+	if (run_command(ifwi_update))
 		goto oops;
 	printf("System will reboot in 3s ....\n");
 	sleep(3);
@@ -264,16 +280,17 @@ oops:
 
 static int mount_package(const char *root_path)
 {
-	char cmd[512] = { '\0', };
+	char *const cmd[] = { "mount", (char *)root_path, PACKAGE_PATH,
+		"-t", "iso9660", "-o", "loop", NULL };
 
 	if (access(PACKAGE_PATH, F_OK)) {
 		if (mkdir(PACKAGE_PATH, 0755))
 			printf("mkdir error, msg: %s\n", strerror(errno));
 	}
 
-	sprintf(cmd, "mount %s %s -t iso9660 -o loop", root_path, PACKAGE_PATH);
+	/* loop mounts need losetup support, leave that to busybox mount */
 	if (run_command(cmd)) {
-		write_to_user("command fail: %s\n", cmd);
+		write_to_user("command fail: mount %s\n", root_path);
 		return INSTALL_ERROR;
 	}
 
@@ -283,10 +300,10 @@ static int mount_package(const char *root_path)
 #if 0
 static int umount_package(const char *root_path)
 {
-	char cmd[512] = { '\0', };
-	sprintf(cmd, "umount -d %s", root_path);
+	char *const cmd[] = { "umount", "-d", (char *)root_path, NULL };
+
 	if (run_command(cmd)) {
-		write_to_user("command fail: %s\n", cmd);
+		write_to_user("command fail: umount -d %s\n", root_path);
 		return INSTALL_ERROR;
 	}
 
@@ -325,14 +342,13 @@ oops:
 
 static int ota_flash()
 {
-	char cmd[512] = { '\0', };
+	char *const cmd[] = { "/bin/sh", PACKAGE_PATH "/setup.sh", NULL };
 
 	if (mount_partition(SYSTEM))
 		goto oops;
 	if (mount_partition(CACHE))
 		goto oops;
-	sprintf(cmd, "/bin/sh %s/setup.sh", PACKAGE_PATH);
-	write_to_user("run command: %s\n", cmd);
+	write_to_user("run command: %s %s\n", cmd[0], cmd[1]);
 
 	if (run_command(cmd))
 		goto oops;
@@ -365,14 +381,14 @@ oops:
 	return INSTALL_ERROR;
 }
 
-#define CMD_IMAGE_VERIFICATION "/chaabi/signed_image_verify.out -f %s"
+#define CMD_IMAGE_VERIFICATION "/chaabi/signed_image_verify.out"
 
 static int install_ota(const char *root_path)
 {
-	char cmd[512];
+	char *const cmd[] = { CMD_IMAGE_VERIFICATION, "-f",
+		(char *)root_path, NULL };
 
-	sprintf(cmd, CMD_IMAGE_VERIFICATION, root_path);
-	if (system(cmd)) {
+	if (run_command(cmd)) {
 		write_to_user("package verification failed\n");
 		goto oops;
 	}
@@ -516,8 +532,6 @@ int ota_update(void)
 	int factory_restore = 0;
 	int arg = -1;
 	int blknum = -1;
-	int devfd;
-	unsigned char rbt_reason;
 
 	blk_number(EMMC_SYS_ENTRY, &blknum);
 
@@ -584,13 +598,8 @@ int ota_update(void)
 		if (status != INSTALL_SUCCESS)
 			write_to_user("Data wipe failed.\n");
 		else {
-			rbt_reason = RR_SIGNED_MOS;
-			if ((devfd = open(IPC_DEVICE_NAME, O_RDWR)) < 0) {
-				write_to_user("unable to open the DEVICE %s\n", IPC_DEVICE_NAME);
-			} else {
-				ioctl(devfd, IPC_WRITE_RR_TO_OSNIB, &rbt_reason);
-				close(devfd);
-			}
+			if (scu_ipc_write_rr(RR_SIGNED_MOS) < 0)
+				write_to_user("unable to write the DEVICE %s\n", IPC_DEVICE_NAME);
 		}
 	} else if (update_package != NULL && type != NULL) {
 		status = install_package(update_package, type, sdcard);
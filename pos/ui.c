@@ -37,6 +37,8 @@
 #include <limits.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 #include <lite/lite.h>
 #include <lite/window.h>
 #include <lite/util.h>
@@ -50,19 +52,28 @@
 #include <leck/slider.h>
 #include <leck/progressbar.h>
 
+#include <sys/inotify.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/types.h>
-#include <sys/msg.h>
 
 #include <linux/fb.h>
 #include <linux/kd.h>
 
 #include "recovery.h"
 #include "textedit.h"
+#include "imagecache.h"
 #include "ui.h"
+#include "event_ring.h"
 
 #define BATTERY_CAPACITY_FULL 100
+#define PROGRESS_FRAMES 6
+#define PROGRESS_FILE "/tmp/progress.txt"
+#define PROGRESS_POLL_MS 500
+/* one step of the charging animation */
+#define CHARGE_TICK_MS 1000
+/* console redraws per second at most: 1000 / CONSOLE_FLUSH_MS */
+#define CONSOLE_FLUSH_MS 200
 
 static LiteWindow *window = NULL;
 static char *labelText = "BKB Provisioning OS";
@@ -72,7 +83,8 @@ static LiteImage *image = NULL;
 static LiteLabel *labelTitle = NULL;
 static LiteLabel *labelConsole = NULL;
 static LiteTextEdit *console = NULL;
-static LiteImage *imageBat = NULL;
+static LiteCachedImage *imageBat = NULL;
+static LiteCachedImage *imageProgress = NULL;
 
 static int main_window_width = 0;
 static int main_window_height = 0;
@@ -89,12 +101,7 @@ typedef struct _logthread {
 	int fd;
 } logthread;
 
-static struct msgtype {
-	long mtype;
-	char buffer[100];
-} msg;
-
-static int msgID;
+static struct event_ring *ring;
 static coordinates logo;
 static coordinates title;
 static coordinates battery;
@@ -104,8 +111,6 @@ static coordinates progress;
 
 static DFBColor black = {a:0, r:0, g:0, b:0};
 static DFBColor white = {a:255, r:255, g:255, b:255};
-static int capacity = 10;
-static int usb_present;
 
 static void rect_init(DFBRectangle * rect, int x, int y, int w, int h)
 {
@@ -182,14 +187,69 @@ int init_ui()
 	return 1;
 }
 
+static long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/* keep the last MAX_SIZE bytes of the pending output, the console
+   never shows more than that */
+static int console_trim(char *pending, int len)
+{
+	if (len <= MAX_SIZE)
+		return len;
+	memmove(pending, pending + len - MAX_SIZE, MAX_SIZE);
+	return MAX_SIZE;
+}
+
+/* the aboot output reaches the console at most every CONSOLE_FLUSH_MS,
+   each flush redraws the whole widget. output that outruns it is cut
+   down to the latest screenful instead of drawing every step. */
 void *get_console_event(void *arg)
 {
-	int n = 0;
-	char line[MAX_SIZE];
+	char pending[2 * MAX_SIZE + 1];
 	logthread *r = (logthread *) arg;
-	while ((n = read(r->fd, line, MAX_SIZE)) > 0) {
-		lite_set_textedit_text(r->console, line);
-		memset(line, 0, strlen(line));
+	struct pollfd pfd;
+	int len = 0, n, timeout;
+	long last = 0;
+
+	pfd.fd = r->fd;
+	pfd.events = POLLIN;
+	for (;;) {
+		timeout = -1;
+		if (len) {
+			timeout = last + CONSOLE_FLUSH_MS - now_ms();
+			if (timeout < 0)
+				timeout = 0;
+		}
+		n = poll(&pfd, 1, timeout);
+		if (n < 0 && errno != EINTR)
+			break;
+		if (n > 0) {
+			len = console_trim(pending, len);
+			n = read(r->fd, pending + len, MAX_SIZE);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				break;
+			len += n;
+		}
+		if (len && now_ms() - last >= CONSOLE_FLUSH_MS) {
+			len = console_trim(pending, len);
+			pending[len] = '\0';
+			lite_set_textedit_text(r->console, pending);
+			len = 0;
+			last = now_ms();
+		}
+	}
+	/* the writer is gone, show what it said last */
+	if (len) {
+		len = console_trim(pending, len);
+		pending[len] = '\0';
+		lite_set_textedit_text(r->console, pending);
 	}
 
 	return NULL;
@@ -198,7 +258,7 @@ void *get_console_event(void *arg)
 int progress_file_read(char *line)
 {
 	int fd;
-	fd = open("/tmp/progress.txt", O_RDONLY);
+	fd = open(PROGRESS_FILE, O_RDONLY);
 	if (fd < 0) {
 		return 0;
 	}
@@ -207,91 +267,127 @@ int progress_file_read(char *line)
 	return 1;
 }
 
+/* aboot and the OTA code rewrite the progress file, /tmp is watched
+   for it so nothing polls while the bar is idle */
 void *change_pic_event(void *arg)
 {
 	char buf[256] = { '\0', };
-	LiteImage *image = (LiteImage *) arg;
+	char evbuf[sizeof(struct inotify_event) + NAME_MAX + 1];
+	LiteCachedImage *image = (LiteCachedImage *) arg;
 	char line;
-	int i;
+	int i, ifd;
+
+	ifd = inotify_init();
+	if (ifd >= 0 && inotify_add_watch(ifd, "/tmp", IN_CLOSE_WRITE) < 0) {
+		close(ifd);
+		ifd = -1;
+	}
+	if (ifd < 0)
+		syslog(LOG_WARNING, "cannot watch /tmp, polling %s\n",
+		       PROGRESS_FILE);
 
 	while (1) {
-		if (progress_file_read(&line)) {
-			switch (line) {
-			case BAR_START:
-				for (i = 0; i < 6; i++) {
-					sprintf(buf, "%s/indeterminate%d.png",
-						get_datadir(), i + 1);
-					lite_load_image(image, buf);
-					usleep(50000);
-				}
-				break;
-			case BAR_FINISH:
+		if (progress_file_read(&line) && line == BAR_START) {
+			for (i = 0; i < PROGRESS_FRAMES; i++) {
+				sprintf(buf, "%s/indeterminate%d.png",
+					get_datadir(), i + 1);
+				lite_set_cached_image(image, buf);
 				usleep(50000);
-				sprintf(buf, "%s/indeterminate1.png",
-					get_datadir());
-				lite_load_image(image, buf);
-				break;
 			}
+			continue;
 		}
+		sprintf(buf, "%s/indeterminate1.png", get_datadir());
+		lite_set_cached_image(image, buf);
+
+		/* any file closed in /tmp, reading the state again is cheap */
+		if (ifd < 0 || (read(ifd, evbuf, sizeof(evbuf)) < 0 && errno != EINTR))
+			usleep(PROGRESS_POLL_MS * 1000);
 	}
+	return NULL;
 }
 
-void *pos_battery_status_update(void *data)
+static void battery_icon(char *buf, int capacity, int usb_present, int pic_no)
 {
-	int pic_no = 0;
 	char *battery_pic_path;
 
+	if (usb_present) {
+		battery_pic_path = "battery_pos_charge";
+		switch (capacity) {
+		case (0)...(BATTERY_CAPACITY_FULL - 1):
+			if (pic_no == 100)
+				sprintf(buf, "%s/%s/stat_sys_battery_full.png",
+					get_datadir(), battery_pic_path);
+			else
+				sprintf(buf, "%s/%s/stat_sys_battery_%d.png",
+					get_datadir(), battery_pic_path,
+					pic_no);
+			break;
+		case BATTERY_CAPACITY_FULL...INT_MAX:
+			sprintf(buf, "%s/%s/stat_sys_battery_full.png",
+				get_datadir(), battery_pic_path);
+			break;
+		default:
+			sprintf(buf,
+				"%s/%s/stat_sys_battery_unknown.png",
+				get_datadir(), battery_pic_path);
+			break;
+		}
+	} else {
+		battery_pic_path = "battery_pos_discharge";
+		switch (capacity) {
+		case (0)...(BATTERY_CAPACITY_FULL - 1):
+			sprintf(buf, "%s/%s/stat_sys_battery_%d.png",
+				get_datadir(), battery_pic_path,
+				capacity - capacity % 5);
+			break;
+		case BATTERY_CAPACITY_FULL...INT_MAX:
+			sprintf(buf, "%s/%s/stat_sys_battery_full.png",
+				get_datadir(), battery_pic_path);
+			break;
+		default:
+			sprintf(buf,
+				"%s/%s/stat_sys_battery_unknown.png",
+				get_datadir(), battery_pic_path);
+			break;
+		}
+	}
+}
+
+/* the icon follows the charger and capacity events. the charging
+   animation steps on a tick that only runs while charging with the
+   screen on; otherwise the thread sleeps until the next event. */
+void *pos_battery_status_update(void *data)
+{
+	char buf[256] = { '\0', };
+	struct event_rec ev;
+	int pic_no = 0, tick = 0, animate, ret;
+	int capacity, usb_present;
+
 	while (1) {
-		char buf[256] = { '\0', };
+		/* the event process keeps the slots current */
+		capacity = event_ring_state(ring, EVENT_BATTERY);
+		usb_present = event_ring_state(ring, EVENT_CHARGER) > 0;
+		animate = usb_present && capacity >= 0 &&
+			  capacity < BATTERY_CAPACITY_FULL &&
+			  event_ring_state(ring, EVENT_SCREEN) != 0;
 
 		if (usb_present) {
-			battery_pic_path = "battery_pos_charge";
-
+			if (tick)
+				pic_no += 20;
 			if (pic_no == 0 || pic_no > 100)
 				pic_no = capacity - capacity % 20;
-			switch (capacity) {
-			case (0)...(BATTERY_CAPACITY_FULL - 1):
-				if (pic_no == 100)
-					sprintf(buf, "%s/%s/stat_sys_battery_full.png",
-						get_datadir(), battery_pic_path);
-				else
-					sprintf(buf, "%s/%s/stat_sys_battery_%d.png",
-						get_datadir(), battery_pic_path,
-						pic_no);
-				break;
-			case BATTERY_CAPACITY_FULL...INT_MAX:
-				sprintf(buf, "%s/%s/stat_sys_battery_full.png",
-					get_datadir(), battery_pic_path);
-				break;
-			default:
-				sprintf(buf,
-					"%s/%s/stat_sys_battery_unknown.png",
-					get_datadir(), battery_pic_path);
-				break;
-			}
-			pic_no += 20;
-		} else {
-			battery_pic_path = "battery_pos_discharge";
-			switch (capacity) {
-			case (0)...(BATTERY_CAPACITY_FULL - 1):
-				sprintf(buf, "%s/%s/stat_sys_battery_%d.png",
-					get_datadir(), battery_pic_path,
-					capacity - capacity % 5);
-				break;
-			case BATTERY_CAPACITY_FULL...INT_MAX:
-				sprintf(buf, "%s/%s/stat_sys_battery_full.png",
-					get_datadir(), battery_pic_path);
-				break;
-			default:
-				sprintf(buf,
-					"%s/%s/stat_sys_battery_unknown.png",
-					get_datadir(), battery_pic_path);
-				break;
-			}
 		}
-		lite_load_image(imageBat, buf);
-		sleep(1);
+		battery_icon(buf, capacity, usb_present, pic_no);
+		/* the same icon again is not redrawn */
+		lite_set_cached_image(imageBat, buf);
+
+		ret = event_ring_timedwait(ring, &ev,
+					   animate ? CHARGE_TICK_MS : -1);
+		if (ret < 0)
+			break;
+		tick = ret;
 	}
+	syslog(LOG_ERR, "event ring wait failed\n");
 	return NULL;
 }
 
@@ -315,7 +411,7 @@ static int create_console_thread(LiteTextEdit * console, int fd)
 	return 0;
 }
 
-static int create_change_pic_thread(LiteImage * image)
+static int create_change_pic_thread(LiteCachedImage * image)
 {
 	pthread_t thr;
 	pthread_attr_t atr;
@@ -330,36 +426,16 @@ static int create_change_pic_thread(LiteImage * image)
 	return 0;
 }
 
-static void *event_listener(void *data)
-{
-	while (1) {
-		msgrcv(msgID, &msg, sizeof(struct msgtype), 0, 0);
-		switch (msg.mtype) {
-		case CHRG_EVENT:
-			if (strcmp(msg.buffer, CHRG_INSERT) == 0)
-				usb_present = 1;
-			else
-				usb_present = 0;
-			break;
-		case BAT_STATUS:
-			capacity = atoi(msg.buffer);
-			break;
-		default:
-			syslog(LOG_WARNING, "Unknown msg type!\n");
-		}
-	}
-	return NULL;
-}
-
-int pos_ui(int argc, char *argv[], int fd, int msgid)
+int pos_ui(int argc, char *argv[], int fd, struct event_ring *r)
 {
 	DFBRectangle rect;
 	DFBResult res;
 	LiteFont *font;
 	IDirectFBFont *font_interface;
 	char buf[256] = { '\0', };
+	int i;
 
-	msgID = msgid;
+	ring = r;
 	/* initialize ui size */
 	if (init_ui() < 0)
 		return 1;
@@ -424,18 +500,7 @@ int pos_ui(int argc, char *argv[], int fd, int msgid)
 
 	/* setup battery logo */
 	rect_init(&rect, battery.x, battery.y, battery.w, battery.h);
-	res =
-	    lite_new_image(LITE_BOX(window), &rect, liteNoImageTheme,
-			   &imageBat);
-	/* mesage queue status monitoring */
-	{
-		pthread_t thrd;
-		pthread_attr_t attr;
-
-		pthread_attr_init(&attr);
-		pthread_create(&thrd, &attr, event_listener, NULL);
-	}
-
+	res = lite_new_cached_image(LITE_BOX(window), &rect, &imageBat);
 	/* battery/charging status monitoring */
 	{
 		pthread_t thread_bat;
@@ -451,15 +516,19 @@ int pos_ui(int argc, char *argv[], int fd, int msgid)
 
 	/* setup the progress_bar */
 	rect_init(&rect, progress.x, progress.y, progress.w, progress.h);
-	res = lite_new_image(LITE_BOX(window), &rect, liteNoImageTheme, &image);
-	sprintf(buf, "%s/indeterminate1.png", get_datadir());
-	lite_load_image(image, buf);
+	res = lite_new_cached_image(LITE_BOX(window), &rect, &imageProgress);
+	/* decode the animation up front, it then only swaps surfaces */
+	for (i = PROGRESS_FRAMES; i > 0; i--) {
+		sprintf(buf, "%s/indeterminate%d.png", get_datadir(), i);
+		lite_preload_cached_image(imageProgress, buf);
+	}
+	lite_set_cached_image(imageProgress, buf);
 
 	/* create log thread */
 	create_console_thread(console, fd);
 
 	/* create progress_bar thread */
-	create_change_pic_thread(image);
+	create_change_pic_thread(imageProgress);
 
 	/* run the default event loop */
 	lite_window_event_loop(window, 0);
@@ -469,6 +538,7 @@ int pos_ui(int argc, char *argv[], int fd, int msgid)
 
 	/* destroy the window with all this children and resources */
 	lite_destroy_window(window);
+	image_cache_flush();
 
 	/* deinitialize */
 	lite_close();
@@ -0,0 +1,257 @@
+/*************************************************************************
+ * Copyright(c) 2012 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * **************************************************************************/
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#include "power_supply.h"
+#include "uevent.h"
+
+#define PS_PREFIX		"POWER_SUPPLY_"
+#define PS_PREFIX_LEN		(sizeof(PS_PREFIX) - 1)
+#define PS_UEVENT_SIZ		1024
+#define PS_MAX_SUPPLIES		8
+#define PS_NAME_SIZ		64
+#define PS_TYPE_SIZ		32
+/* poll period when no uevent socket can be had */
+#define PS_FIND_POLL_MS		100
+
+static const char *status_text[] = {
+	"Unknown", "Charging", "Discharging", "Not charging", "Full"
+};
+
+/* keys we care about, in PS_* bit order */
+static const struct ps_key {
+	const char *name;
+	unsigned char len;
+	unsigned char offset;
+} ps_keys[] = {
+#define PS_KEY(key, field) \
+	{ #key, sizeof(#key) - 1, offsetof(struct power_supply_status, field) }
+	PS_KEY(PRESENT, present),
+	PS_KEY(VOLTAGE_NOW, voltage_now),
+	PS_KEY(CURRENT_NOW, current_now),
+	PS_KEY(CAPACITY, capacity),
+	PS_KEY(TEMP, temp),
+	PS_KEY(CHARGE_NOW, charge_now),
+	PS_KEY(CHARGE_FULL, charge_full),
+	PS_KEY(CHARGE_FULL_DESIGN, charge_full_design),
+	PS_KEY(STATUS, status),
+#undef PS_KEY
+};
+#define PS_KEY_COUNT	(int)(sizeof(ps_keys) / sizeof(ps_keys[0]))
+
+/* every supply found in sysfs, filled by scan_supplies() */
+static struct {
+	char name[PS_NAME_SIZ];
+	char type[PS_TYPE_SIZ];
+} supplies[PS_MAX_SUPPLIES];
+static int nr_supplies = -1;	/* -1 until the first scan */
+static pthread_mutex_t supplies_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/* record the type of every supply in a single pass over the directory */
+static void scan_supplies(void)
+{
+	char path[POWER_SUPPLY_PATH_SIZ];
+	struct dirent *de;
+	DIR *dir;
+	int fd, len;
+
+	nr_supplies = 0;
+	if ((dir = opendir(SYSFS_POWER_SUPPLY)) == NULL)
+		return;
+	while ((de = readdir(dir)) != NULL && nr_supplies < PS_MAX_SUPPLIES) {
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), SYSFS_POWER_SUPPLY "/%s/type",
+			 de->d_name);
+		if ((fd = open(path, O_RDONLY)) < 0)
+			continue;
+		len = read(fd, supplies[nr_supplies].type, PS_TYPE_SIZ - 1);
+		close(fd);
+		if (len <= 0)
+			continue;
+		while (len > 0 && supplies[nr_supplies].type[len - 1] == '\n')
+			len--;
+		supplies[nr_supplies].type[len] = '\0';
+		snprintf(supplies[nr_supplies].name, PS_NAME_SIZ, "%s",
+			 de->d_name);
+		nr_supplies++;
+	}
+	closedir(dir);
+}
+
+static int lookup_supply(struct power_supply *ps, const char *type)
+{
+	int i;
+
+	for (i = 0; i < nr_supplies; i++) {
+		if (strstr(supplies[i].type, type) != NULL) {
+			power_supply_init(ps, supplies[i].name);
+			return 0;
+		}
+	}
+	return -ENOENT;
+}
+
+int power_supply_find(struct power_supply *ps, const char *type,
+		      int timeout_ms)
+{
+	struct uevent_listener ul;
+	long deadline;
+	int ret, left;
+
+	pthread_mutex_lock(&supplies_lock);
+	if (nr_supplies < 0)
+		scan_supplies();
+	if ((ret = lookup_supply(ps, type)) == 0)
+		goto out;
+
+	/* listen before rescanning so an add in between is not lost */
+	if (uevent_open(&ul, "power_supply"))
+		ul.fd = -1;
+	deadline = now_ms() + timeout_ms;
+	for (;;) {
+		scan_supplies();
+		if ((ret = lookup_supply(ps, type)) == 0)
+			break;
+		if ((left = deadline - now_ms()) <= 0)
+			break;
+		if (ul.fd < 0)
+			usleep((left < PS_FIND_POLL_MS ? left : PS_FIND_POLL_MS) * 1000);
+		else if (uevent_wait(&ul, left, 0) < 0)
+			break;
+	}
+	uevent_close(&ul);
+out:
+	pthread_mutex_unlock(&supplies_lock);
+	return ret;
+}
+
+void power_supply_init(struct power_supply *ps, const char *name)
+{
+	snprintf(ps->path, sizeof(ps->path), SYSFS_POWER_SUPPLY "/%s/uevent",
+		 name);
+	ps->fd = -1;
+	memset(&ps->st, 0, sizeof(ps->st));
+}
+
+void power_supply_close(struct power_supply *ps)
+{
+	if (ps->fd >= 0)
+		close(ps->fd);
+	ps->fd = -1;
+}
+
+const char *power_supply_status_text(int status)
+{
+	if (status < 0 || status >= POWER_SUPPLY_STATUS_COUNT)
+		status = POWER_SUPPLY_STATUS_UNKNOWN;
+	return status_text[status];
+}
+
+static int parse_int(const char *p, const char *end)
+{
+	int v = 0, neg = 0;
+
+	if (p < end && *p == '-') {
+		neg = 1;
+		p++;
+	}
+	while (p < end && *p >= '0' && *p <= '9')
+		v = v * 10 + (*p++ - '0');
+	return neg ? -v : v;
+}
+
+static int parse_status(const char *p, const char *end)
+{
+	int i;
+
+	for (i = 0; i < POWER_SUPPLY_STATUS_COUNT; i++) {
+		if (strlen(status_text[i]) == (size_t)(end - p) &&
+		    !memcmp(p, status_text[i], end - p))
+			return i;
+	}
+	return POWER_SUPPLY_STATUS_UNKNOWN;
+}
+
+int power_supply_read(struct power_supply *ps)
+{
+	char buf[PS_UEVENT_SIZ];
+	const char *p, *eq, *eol, *end;
+	int len, i, v, *field, changed = 0;
+
+	if (ps->fd < 0) {
+		ps->fd = open(ps->path, O_RDONLY);
+		if (ps->fd < 0)
+			return -1;
+	}
+
+	/* sysfs regenerates the attribute on every read from offset 0 */
+	len = pread(ps->fd, buf, sizeof(buf), 0);
+	if (len <= 0) {
+		power_supply_close(ps);
+		return -1;
+	}
+
+	/* one pass over "POWER_SUPPLY_<KEY>=<value>\n" lines */
+	for (p = buf, end = buf + len; p < end; p = eol + 1) {
+		eol = memchr(p, '\n', end - p);
+		if (eol == NULL) {
+			/* truncated last line */
+			if (len == sizeof(buf))
+				break;
+			eol = end;
+		}
+		if ((size_t)(eol - p) <= PS_PREFIX_LEN ||
+		    memcmp(p, PS_PREFIX, PS_PREFIX_LEN))
+			continue;
+		p += PS_PREFIX_LEN;
+		eq = memchr(p, '=', eol - p);
+		if (eq == NULL)
+			continue;
+
+		for (i = 0; i < PS_KEY_COUNT; i++) {
+			if (ps_keys[i].len != eq - p ||
+			    memcmp(p, ps_keys[i].name, ps_keys[i].len))
+				continue;
+			if ((1 << i) == PS_STATUS)
+				v = parse_status(eq + 1, eol);
+			else
+				v = parse_int(eq + 1, eol);
+			field = (int *)((char *)&ps->st + ps_keys[i].offset);
+			if (*field != v) {
+				*field = v;
+				changed |= 1 << i;
+			}
+			break;
+		}
+	}
+	return changed;
+}
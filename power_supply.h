@@ -0,0 +1,83 @@
+/*************************************************************************
+ * Copyright(c) 2012 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * **************************************************************************/
+#ifndef POWER_SUPPLY_H
+#define POWER_SUPPLY_H
+
+#define SYSFS_POWER_SUPPLY	"/sys/class/power_supply"
+#define POWER_SUPPLY_PATH_SIZ	255
+/* how long a slow probing driver gets to register its supply */
+#define POWER_SUPPLY_FIND_MS	4000
+
+/* Extract from Kernel's power_supply_sysfs.c */
+typedef enum {
+	POWER_SUPPLY_STATUS_UNKNOWN,
+	POWER_SUPPLY_STATUS_CHARGING,
+	POWER_SUPPLY_STATUS_DISCHARGING,
+	POWER_SUPPLY_STATUS_NOT_CHARGING,
+	POWER_SUPPLY_STATUS_FULL,
+	POWER_SUPPLY_STATUS_COUNT,
+} POWER_SUPPLY_STATUS;
+
+/* bits returned by power_supply_read() for the fields that changed */
+#define PS_PRESENT		(1 << 0)
+#define PS_VOLTAGE_NOW		(1 << 1)
+#define PS_CURRENT_NOW		(1 << 2)
+#define PS_CAPACITY		(1 << 3)
+#define PS_TEMP			(1 << 4)
+#define PS_CHARGE_NOW		(1 << 5)
+#define PS_CHARGE_FULL		(1 << 6)
+#define PS_CHARGE_FULL_DESIGN	(1 << 7)
+#define PS_STATUS		(1 << 8)
+
+/* values as last read from the uevent file. only ints, so there is
+   no padding and a snapshot can be copied or compared as a whole */
+struct power_supply_status {
+	int present;
+	int voltage_now;
+	int current_now;
+	int capacity;
+	int temp;
+	int charge_now;
+	int charge_full;
+	int charge_full_design;
+	int status;			/* POWER_SUPPLY_STATUS */
+};
+
+struct power_supply {
+	char path[POWER_SUPPLY_PATH_SIZ];	/* .../uevent */
+	int fd;
+	struct power_supply_status st;
+};
+
+/* bind ps to the first supply whose sysfs type contains type. sysfs
+   is scanned once per process and the result cached; while no such
+   supply exists, wait up to timeout_ms for it to be added.
+   returns 0, or -ENOENT. */
+int power_supply_find(struct power_supply *ps, const char *type,
+		      int timeout_ms);
+
+/* bind ps to the uevent file of the sysfs entry name; the file is
+   opened on first read and kept open. */
+void power_supply_init(struct power_supply *ps, const char *name);
+
+/* refresh ps->st. returns the PS_* mask of changed fields (0 when
+   nothing moved), or -1 if the file cannot be read. */
+int power_supply_read(struct power_supply *ps);
+
+void power_supply_close(struct power_supply *ps);
+
+const char *power_supply_status_text(int status);
+
+#endif
@@ -52,16 +52,15 @@ char *get_datadir()
 
 int get_poweron_reason()
 {
-	int devfd, errNo;
-	unsigned char rbt_reason;
+	unsigned char rbt_reason = 0;
 
-	if ((devfd = open(IPC_DEVICE_NAME, O_RDWR)) < 0) {
+	if (scu_ipc_open() < 0) {
 		syslog(LOG_ERR, "unable to open the DEVICE %s\n", IPC_DEVICE_NAME);
 		exit(1);
 	}
 
-	if ((errNo = ioctl(devfd, IPC_READ_RR_FROM_OSNIB, &rbt_reason)) < 0) {
-		syslog(LOG_ERR, "ioctl for DEVICE %s, returns error-%d\n", IPC_DEVICE_NAME, errNo);
+	if (scu_ipc_read_rr(&rbt_reason) < 0) {
+		syslog(LOG_ERR, "ioctl for DEVICE %s, returns error-%d\n", IPC_DEVICE_NAME, errno);
 	}
 
 	syslog(LOG_DEBUG, "OSNIBR.RR = %x\n", rbt_reason);
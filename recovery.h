@@ -35,12 +35,8 @@
 #include <stdlib.h>
 #include <syslog.h>
 
-#define IPC_DEVICE_NAME		    "/dev/mid_ipc"
-#define IPC_READ_RR_FROM_OSNIB	0xC1
-#define IPC_WRITE_RR_TO_OSNIB	0xC2
-#define IPC_WRITE_ALARM_TO_OSNIB 0xC5
-#define IPC_COLD_RESET		    0xC3
-#define IPC_READ_VBATTCRIT	    0xC4
+#include "scu_ipc.h"
+
 #define RR_SIGNED_MOS		    0x0
 #define RR_SIGNED_COS           0xa
 
@@ -53,19 +49,4 @@ extern void android_reboot(void);
 char *get_datadir();
 #define MAX_SIZE   (33*55)
 
-#define COS_CHRG_EVENT	 1
-#define COS_CHRG_REMOVE	 "u:0"
-#define COS_CHRG_INSERT	 "u:1"
-#define COS_VOL_GATE	 2
-#define COS_VOL_LOW	 "b:0"
-#define COS_VOL_HIGH	 "b:1"
-#define CHRG_EVENT	 3
-#define CHRG_INSERT	 "c:1"
-#define CHRG_REMOVE	 "c:0"
-#define BAT_STATUS	 8
-#define BAT_PRESENT	 "bta:0"
-#define COS_BOOT_MOS	 9
-#define COS_BOOT_MOS_BUF "mos"
-#define COS_BAT_STATUS	 10
-#define COS_TEMP_EVENT 5
 #endif // __MAIN_H__
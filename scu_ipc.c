@@ -0,0 +1,153 @@
+/*************************************************************************
+ * Copyright(c) 2012 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * **************************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "scu_ipc.h"
+
+static pthread_mutex_t ipc_lock = PTHREAD_MUTEX_INITIALIZER;
+static int ipc_fd = -1;
+
+static struct scu_ipc_version fw_version;
+static int fw_version_valid;
+static unsigned int voltage_gate;
+static int voltage_gate_valid;
+
+/* callers hold ipc_lock */
+static int ipc_open_locked(void)
+{
+	if (ipc_fd < 0)
+		ipc_fd = open(IPC_DEVICE_NAME, O_RDWR);
+	return ipc_fd < 0 ? -1 : 0;
+}
+
+static int ipc_ioctl_locked(unsigned int cmd, void *arg)
+{
+	if (ipc_open_locked() < 0)
+		return -1;
+	return ioctl(ipc_fd, cmd, arg) < 0 ? -1 : 0;
+}
+
+static int fw_version_locked(void)
+{
+	struct scu_ipc_version v;
+
+	if (fw_version_valid)
+		return 0;
+	memset(&v, 0, sizeof(v));
+	v.count = sizeof(v.data);	/* read back 16 bytes fw info */
+	if (ipc_ioctl_locked(INTE_SCU_IPC_FW_REVISION_GET, &v) < 0)
+		return -1;
+	fw_version = v;
+	fw_version_valid = 1;
+	return 0;
+}
+
+static int voltage_gate_locked(void)
+{
+	unsigned int val;
+
+	if (voltage_gate_valid)
+		return 0;
+	if (ipc_ioctl_locked(IPC_READ_VBATTCRIT, &val) < 0)
+		return -1;
+	/* VBATTCRIT is the upper half word, in mV */
+	voltage_gate = (val >> 16) * 1000;
+	voltage_gate_valid = 1;
+	return 0;
+}
+
+int scu_ipc_open(void)
+{
+	int ret;
+
+	pthread_mutex_lock(&ipc_lock);
+	ret = ipc_open_locked();
+	pthread_mutex_unlock(&ipc_lock);
+	return ret;
+}
+
+void scu_ipc_close(void)
+{
+	pthread_mutex_lock(&ipc_lock);
+	if (ipc_fd >= 0)
+		close(ipc_fd);
+	ipc_fd = -1;
+	pthread_mutex_unlock(&ipc_lock);
+}
+
+int scu_ipc_ioctl(unsigned int cmd, void *arg)
+{
+	int ret;
+
+	pthread_mutex_lock(&ipc_lock);
+	ret = ipc_ioctl_locked(cmd, arg);
+	pthread_mutex_unlock(&ipc_lock);
+	return ret;
+}
+
+int scu_ipc_probe(void)
+{
+	int ret;
+
+	pthread_mutex_lock(&ipc_lock);
+	ret = fw_version_locked();
+	ret |= voltage_gate_locked();
+	pthread_mutex_unlock(&ipc_lock);
+	return ret;
+}
+
+int scu_ipc_fw_version(struct scu_ipc_version *version)
+{
+	int ret;
+
+	pthread_mutex_lock(&ipc_lock);
+	ret = fw_version_locked();
+	if (ret == 0)
+		*version = fw_version;
+	pthread_mutex_unlock(&ipc_lock);
+	return ret;
+}
+
+int scu_ipc_voltage_gate(unsigned int *uv)
+{
+	int ret;
+
+	pthread_mutex_lock(&ipc_lock);
+	ret = voltage_gate_locked();
+	if (ret == 0)
+		*uv = voltage_gate;
+	pthread_mutex_unlock(&ipc_lock);
+	return ret;
+}
+
+int scu_ipc_read_rr(unsigned char *rr)
+{
+	return scu_ipc_ioctl(IPC_READ_RR_FROM_OSNIB, rr);
+}
+
+int scu_ipc_write_rr(unsigned char rr)
+{
+	return scu_ipc_ioctl(IPC_WRITE_RR_TO_OSNIB, &rr);
+}
+
+int scu_ipc_write_alarm(int alarm)
+{
+	return scu_ipc_ioctl(IPC_WRITE_ALARM_TO_OSNIB, &alarm);
+}
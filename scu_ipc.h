@@ -0,0 +1,58 @@
+/*************************************************************************
+ * Copyright(c) 2012 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * **************************************************************************/
+#ifndef SCU_IPC_H
+#define SCU_IPC_H
+
+#define IPC_DEVICE_NAME		    "/dev/mid_ipc"
+#define IPC_READ_RR_FROM_OSNIB	0xC1
+#define IPC_WRITE_RR_TO_OSNIB	0xC2
+#define IPC_COLD_RESET		    0xC3
+#define IPC_READ_VBATTCRIT	    0xC4
+#define IPC_WRITE_ALARM_TO_OSNIB 0xC5
+#define INTE_SCU_IPC_FW_REVISION_GET  0xB0
+
+struct scu_ipc_version {
+	unsigned int	count;  /* length of version info */
+	unsigned char	data[16]; /* version data */
+};
+
+/*
+ * Client for the SCU IPC driver. The device is opened once and every
+ * request is serialized on it, as the SCU handles one command at a
+ * time. Values that cannot change while we run (firmware revisions,
+ * VBATTCRIT) are read once and then served from memory.
+ *
+ * All calls return 0 on success and -1 with errno set on failure.
+ */
+
+/* open the device if needed. */
+int scu_ipc_open(void);
+void scu_ipc_close(void);
+
+/* raw request on the shared fd. */
+int scu_ipc_ioctl(unsigned int cmd, void *arg);
+
+/* read the cached values in one go, saves a round trip per value later. */
+int scu_ipc_probe(void);
+
+int scu_ipc_fw_version(struct scu_ipc_version *version);
+/* IA_APPS_RUN battery threshold, in uV. */
+int scu_ipc_voltage_gate(unsigned int *uv);
+
+int scu_ipc_read_rr(unsigned char *rr);
+int scu_ipc_write_rr(unsigned char rr);
+int scu_ipc_write_alarm(int alarm);
+
+#endif
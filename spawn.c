@@ -0,0 +1,258 @@
+/*************************************************************************
+ * Copyright(c) 2012 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * **************************************************************************/
+#define _GNU_SOURCE		/* pipe2() */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "spawn.h"
+
+#define SPAWN_READ_SIZE		512
+#define SPAWN_WRITE_SIZE	(64 * 1024)
+#define SYSFS_POLL_MS		20
+
+static long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/* feed the child's stdin and drain its output until both pipes are closed */
+static void spawn_pump(int in_fd, int out_fd, const struct spawn_opts *opts)
+{
+	const char *in = opts->input;
+	unsigned done = 0;
+	char buf[SPAWN_READ_SIZE];
+	struct pollfd pfd[2];
+	int n, r;
+
+	if (in_fd >= 0)
+		fcntl(in_fd, F_SETFL, fcntl(in_fd, F_GETFL) | O_NONBLOCK);
+
+	while (in_fd >= 0 || out_fd >= 0) {
+		n = 0;
+		if (in_fd >= 0) {
+			pfd[n].fd = in_fd;
+			pfd[n++].events = POLLOUT;
+		}
+		if (out_fd >= 0) {
+			pfd[n].fd = out_fd;
+			pfd[n++].events = POLLIN;
+		}
+		if (poll(pfd, n, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (n--; n >= 0; n--) {
+			if (!pfd[n].revents)
+				continue;
+			if (pfd[n].fd == in_fd) {
+				unsigned len = opts->input_len - done;
+
+				if (len > SPAWN_WRITE_SIZE)
+					len = SPAWN_WRITE_SIZE;
+				r = write(in_fd, in + done, len);
+				if (r < 0 && (errno == EAGAIN || errno == EINTR))
+					continue;
+				if (r > 0) {
+					done += r;
+					if (opts->input_progress)
+						opts->input_progress(done,
+							opts->input_len, opts->data);
+				}
+				/* child went away or everything was written */
+				if (r <= 0 || done == opts->input_len) {
+					close(in_fd);
+					in_fd = -1;
+				}
+			} else {
+				r = read(out_fd, buf, sizeof(buf));
+				if (r < 0 && errno == EINTR)
+					continue;
+				if (r <= 0) {
+					close(out_fd);
+					out_fd = -1;
+				} else
+					opts->output(buf, r, opts->data);
+			}
+		}
+	}
+
+	if (in_fd >= 0)
+		close(in_fd);
+	if (out_fd >= 0)
+		close(out_fd);
+}
+
+int spawn_run(char *const argv[], const struct spawn_opts *opts,
+	      struct spawn_result *res)
+{
+	static const struct spawn_opts no_opts;
+	int in_pipe[2] = {-1, -1}, out_pipe[2] = {-1, -1};
+	int status = 0, ret = -1, piped;
+	sigset_t pipeset, oldset, pending;
+	struct timespec zero = {0, 0};
+	long start;
+	pid_t pid;
+
+	if (!argv || !argv[0])
+		return -1;
+	if (!opts)
+		opts = &no_opts;
+
+	/* close-on-exec: a child spawned by another thread at the same
+	   time must not inherit our ends and hold off the EOF. dup2()
+	   clears the flag on what the child really uses. */
+	if (opts->input && pipe2(in_pipe, O_CLOEXEC) < 0)
+		return -1;
+	if (opts->output && pipe2(out_pipe, O_CLOEXEC) < 0) {
+		if (opts->input) {
+			close(in_pipe[0]);
+			close(in_pipe[1]);
+		}
+		return -1;
+	}
+
+	/* a child that exits early must not kill us while we feed it.
+	   only this thread blocks SIGPIPE, the disposition is left alone
+	   for the other threads and for the child. */
+	sigemptyset(&pipeset);
+	sigaddset(&pipeset, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &pipeset, &oldset);
+	sigpending(&pending);
+	piped = sigismember(&pending, SIGPIPE);
+	start = now_ms();
+
+	switch (pid = vfork()) {
+	case -1:
+		break;
+	case 0:
+		signal(SIGPIPE, SIG_DFL);
+		sigprocmask(SIG_SETMASK, &oldset, NULL);
+		if (in_pipe[0] >= 0) {
+			dup2(in_pipe[0], STDIN_FILENO);
+			close(in_pipe[0]);
+			close(in_pipe[1]);
+		}
+		if (out_pipe[1] >= 0) {
+			dup2(out_pipe[1], STDOUT_FILENO);
+			dup2(out_pipe[1], STDERR_FILENO);
+			close(out_pipe[0]);
+			close(out_pipe[1]);
+		}
+		execvp(argv[0], argv);
+		_exit(127);
+	default:
+		if (in_pipe[0] >= 0)
+			close(in_pipe[0]);
+		if (out_pipe[1] >= 0)
+			close(out_pipe[1]);
+		if (in_pipe[1] >= 0 || out_pipe[0] >= 0)
+			spawn_pump(in_pipe[1], out_pipe[0], opts);
+		in_pipe[1] = out_pipe[0] = -1;
+
+		while (waitpid(pid, &status, 0) < 0) {
+			if (errno != EINTR) {
+				status = -1;
+				break;
+			}
+		}
+		if (status != -1 && WIFEXITED(status))
+			ret = WEXITSTATUS(status);
+		break;
+	}
+
+	if (pid < 0) {
+		status = -1;
+		if (in_pipe[0] >= 0) {
+			close(in_pipe[0]);
+			close(in_pipe[1]);
+		}
+		if (out_pipe[0] >= 0) {
+			close(out_pipe[0]);
+			close(out_pipe[1]);
+		}
+	}
+	/* drop the SIGPIPE our writes raised, not one that was pending */
+	if (!piped) {
+		sigpending(&pending);
+		if (sigismember(&pending, SIGPIPE))
+			sigtimedwait(&pipeset, NULL, &zero);
+	}
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	if (res) {
+		res->status = status;
+		res->elapsed_ms = now_ms() - start;
+	}
+	return ret;
+}
+
+int spawn_cmd(char *const argv[])
+{
+	return spawn_run(argv, NULL, NULL);
+}
+
+void spawn_cmdline(char *const argv[], char *buf, int size)
+{
+	int len = 0, i;
+
+	buf[0] = '\0';
+	for (i = 0; argv[i] && len < size - 1; i++) {
+		len += snprintf(buf + len, size - len, "%s%s",
+				i ? " " : "", argv[i]);
+		if (len > size - 1)
+			len = size - 1;
+	}
+}
+
+int sysfs_write(const char *path, const char *val)
+{
+	int fd, len = strlen(val), ret;
+
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		return -1;
+	do {
+		ret = write(fd, val, len);
+	} while (ret < 0 && errno == EINTR);
+	close(fd);
+	return ret == len ? 0 : -1;
+}
+
+int sysfs_wait_path(const char *path, int exists, int timeout_ms)
+{
+	long deadline = now_ms() + timeout_ms;
+
+	for (;;) {
+		if ((access(path, F_OK) == 0) == !!exists)
+			return 0;
+		if (now_ms() >= deadline)
+			return -1;
+		usleep(SYSFS_POLL_MS * 1000);
+	}
+}
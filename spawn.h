@@ -0,0 +1,58 @@
+/*************************************************************************
+ * Copyright(c) 2012 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * **************************************************************************/
+#ifndef SPAWN_H
+#define SPAWN_H
+
+/*
+ * Shell-free process execution shared by aboot, the OTA path and fastboot.
+ * argv[0] is looked up in PATH unless it contains a '/'.
+ */
+
+/* called for every chunk the child writes on stdout/stderr */
+typedef void (*spawn_output_cb)(const char *buf, int len, void *data);
+
+struct spawn_opts {
+	const void *input;		/* written to the child's stdin, NULL to inherit */
+	unsigned input_len;
+	/* called as input is consumed, NULL if not interested */
+	void (*input_progress)(unsigned done, unsigned total, void *data);
+	spawn_output_cb output;		/* NULL to inherit stdout/stderr */
+	void *data;
+};
+
+struct spawn_result {
+	int status;			/* raw waitpid() status */
+	long elapsed_ms;		/* from fork to reap */
+};
+
+/* returns the exit code of the child, or -1 if it could not be run
+   or was killed by a signal. opts and res may be NULL. */
+int spawn_run(char *const argv[], const struct spawn_opts *opts,
+	      struct spawn_result *res);
+
+/* spawn_run() with inherited stdio */
+int spawn_cmd(char *const argv[]);
+
+/* argv joined by spaces into buf, truncated to size, for the logs */
+void spawn_cmdline(char *const argv[], char *buf, int size);
+
+/* write a value to a sysfs attribute without going through a shell */
+int sysfs_write(const char *path, const char *val);
+
+/* poll until path exists (exists = 1) or is gone (exists = 0).
+   returns 0 on success, -1 on timeout. */
+int sysfs_wait_path(const char *path, int exists, int timeout_ms);
+
+#endif
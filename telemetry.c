@@ -0,0 +1,231 @@
+/*************************************************************************
+ * Copyright(c) 2012 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * **************************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "power_supply.h"
+#include "telemetry.h"
+
+#define TELEMETRY_PATH_SIZ	128
+
+/* records of one type, written to the file in batches */
+struct ring {
+	void *rec;
+	unsigned size;			/* records */
+	unsigned rec_size;
+	unsigned long total;		/* records ever added */
+	unsigned long flushed;		/* records written to the file */
+};
+
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct telemetry_sample sample_buf[TELEMETRY_SAMPLES];
+static struct telemetry_counter counter_buf[TELEMETRY_COUNTERS];
+static struct ring samples = {
+	sample_buf, TELEMETRY_SAMPLES, sizeof(struct telemetry_sample), 0, 0
+};
+static struct ring counters = {
+	counter_buf, TELEMETRY_COUNTERS, sizeof(struct telemetry_counter), 0, 0
+};
+static char log_path[TELEMETRY_PATH_SIZ];
+static int header_written;
+
+static uint32_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void telemetry_init(const char *path)
+{
+	pthread_mutex_lock(&ring_lock);
+	if (path)
+		snprintf(log_path, sizeof(log_path), "%s", path);
+	else
+		log_path[0] = '\0';
+	samples.total = samples.flushed = 0;
+	counters.total = counters.flushed = 0;
+	header_written = 0;
+	pthread_mutex_unlock(&ring_lock);
+}
+
+/* move the log aside when len more bytes would make it too big */
+static void rotate_log(size_t len)
+{
+	char old[TELEMETRY_PATH_SIZ + 4];
+	struct stat st;
+
+	if (stat(log_path, &st) == 0 && st.st_size + len > TELEMETRY_FILE_MAX) {
+		snprintf(old, sizeof(old), "%s.old", log_path);
+		rename(log_path, old);
+		header_written = 0;
+	}
+}
+
+static unsigned long ring_pending(const struct ring *r)
+{
+	unsigned long pending = r->total - r->flushed;
+
+	/* whatever the ring already overwrote is lost */
+	return pending > r->size ? r->size : pending;
+}
+
+static char *ring_at(const struct ring *r, unsigned long i)
+{
+	return (char *)r->rec + (i % r->size) * r->rec_size;
+}
+
+/* add the pending records, at most two runs of the ring, to iov */
+static int ring_iov(const struct ring *r, struct iovec *iov)
+{
+	unsigned long pending = ring_pending(r);
+	unsigned first = (r->total - pending) % r->size;
+	int n = 0;
+
+	if (pending == 0)
+		return 0;
+	iov[n].iov_base = ring_at(r, first);
+	if (first + pending > r->size) {
+		iov[n++].iov_len = (r->size - first) * r->rec_size;
+		iov[n].iov_base = r->rec;
+		iov[n++].iov_len = (first + pending - r->size) * r->rec_size;
+	} else
+		iov[n++].iov_len = pending * r->rec_size;
+	return n;
+}
+
+static int flush_locked(void)
+{
+	struct telemetry_header hdr;
+	struct iovec iov[5];
+	size_t len;
+	int fd, i, n = 0, ret;
+
+	len = ring_pending(&samples) * samples.rec_size +
+		ring_pending(&counters) * counters.rec_size;
+	if (!log_path[0] || len == 0)
+		return 0;
+
+	rotate_log(sizeof(hdr) + len);
+	if (!header_written) {
+		hdr.magic = TELEMETRY_MAGIC;
+		hdr.version = TELEMETRY_VERSION;
+		hdr.sample_size = sizeof(struct telemetry_sample);
+		hdr.wall_time = time(NULL);
+		hdr.start_ms = now_ms();
+		iov[n].iov_base = &hdr;
+		iov[n++].iov_len = sizeof(hdr);
+	}
+	n += ring_iov(&samples, &iov[n]);
+	n += ring_iov(&counters, &iov[n]);
+	for (len = 0, i = 0; i < n; i++)
+		len += iov[i].iov_len;
+
+	if ((fd = open(log_path, O_WRONLY | O_APPEND | O_CREAT, 0640)) < 0)
+		return -1;
+	ret = writev(fd, iov, n);
+	close(fd);
+	if (ret != (int)len)
+		return -1;
+
+	header_written = 1;
+	samples.flushed = samples.total;
+	counters.flushed = counters.total;
+	return 0;
+}
+
+int telemetry_flush(void)
+{
+	int ret;
+
+	pthread_mutex_lock(&ring_lock);
+	ret = flush_locked();
+	pthread_mutex_unlock(&ring_lock);
+	return ret;
+}
+
+/* callers hold ring_lock */
+static void push_locked(struct ring *r, const void *rec)
+{
+	memcpy(ring_at(r, r->total), rec, r->rec_size);
+	r->total++;
+	if (r->total - r->flushed >= TELEMETRY_FLUSH_SAMPLES)
+		flush_locked();
+}
+
+void telemetry_add(const struct power_supply_status *battery, int charger)
+{
+	struct telemetry_sample s;
+
+	s.time_ms = now_ms();
+	s.voltage = battery->voltage_now;
+	s.current = battery->current_now;
+	s.temp = battery->temp;
+	s.capacity = battery->capacity;
+	s.flags = (charger ? TELEMETRY_CHARGER : 0) |
+		battery->status << TELEMETRY_STATUS_SHIFT;
+	pthread_mutex_lock(&ring_lock);
+	push_locked(&samples, &s);
+	pthread_mutex_unlock(&ring_lock);
+}
+
+void telemetry_add_counter(int id, unsigned long count,
+			   unsigned long long cpu_ns)
+{
+	struct telemetry_counter c;
+
+	c.time_ms = now_ms();
+	c.count = count;
+	c.cpu_ms = cpu_ns / 1000000;
+	c.id = id;
+	c.reserved = 0;
+	c.flags = TELEMETRY_COUNTER;
+	pthread_mutex_lock(&ring_lock);
+	push_locked(&counters, &c);
+	pthread_mutex_unlock(&ring_lock);
+}
+
+static int snapshot(const struct ring *r, void *out, int max)
+{
+	unsigned long i, n;
+
+	pthread_mutex_lock(&ring_lock);
+	n = r->total < r->size ? r->total : r->size;
+	if (n > (unsigned long)max)
+		n = max;
+	for (i = 0; i < n; i++)
+		memcpy((char *)out + i * r->rec_size,
+		       ring_at(r, r->total - n + i), r->rec_size);
+	pthread_mutex_unlock(&ring_lock);
+	return n;
+}
+
+int telemetry_snapshot(struct telemetry_sample *out, int max)
+{
+	return snapshot(&samples, out, max);
+}
+
+int telemetry_counter_snapshot(struct telemetry_counter *out, int max)
+{
+	return snapshot(&counters, out, max);
+}
@@ -0,0 +1,90 @@
+/*************************************************************************
+ * Copyright(c) 2012 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * **************************************************************************/
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+
+struct power_supply_status;
+
+/*
+ * Battery time series. Samples go into a fixed ring in memory and are
+ * appended to a file in binary batches, so charging curves can be
+ * pulled from the field without a write per sample.
+ *
+ * File layout: a telemetry_header each time the log is (re)opened by
+ * a new boot, followed by telemetry_sample records, little endian.
+ * Since version 2 telemetry_counter records are mixed in. Both are
+ * sample_size bytes and end with the flags byte, TELEMETRY_COUNTER
+ * tells them apart. Counters have their own ring, so they never push
+ * battery samples out.
+ */
+#define TELEMETRY_MAGIC		0x4d4c5442	/* "BTLM" */
+#define TELEMETRY_VERSION	2
+#define TELEMETRY_SAMPLES	1024		/* ring size */
+#define TELEMETRY_COUNTERS	256		/* counter ring size */
+#define TELEMETRY_FLUSH_SAMPLES	64		/* samples per file write */
+#define TELEMETRY_FILE_MAX	(512 * 1024)	/* then rotate to <path>.old */
+
+/* sample flags */
+#define TELEMETRY_CHARGER	(1 << 0)	/* charger present */
+#define TELEMETRY_COUNTER	(1 << 1)	/* a telemetry_counter record */
+#define TELEMETRY_STATUS_SHIFT	4		/* POWER_SUPPLY_STATUS */
+
+struct telemetry_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t sample_size;
+	uint32_t wall_time;	/* time(NULL) when the session started */
+	uint32_t start_ms;	/* monotonic clock at the same moment */
+} __attribute__((packed));
+
+struct telemetry_sample {
+	uint32_t time_ms;	/* monotonic */
+	int32_t voltage;	/* uV */
+	int32_t current;	/* uA */
+	int16_t temp;		/* 0.1 C */
+	uint8_t capacity;	/* % */
+	uint8_t flags;
+} __attribute__((packed));
+
+/* totals of a wakeup source, see wakeup.h */
+struct telemetry_counter {
+	uint32_t time_ms;	/* monotonic */
+	uint32_t count;		/* wakeups */
+	uint32_t cpu_ms;	/* thread CPU time */
+	uint16_t id;		/* wakeup source id */
+	uint8_t reserved;
+	uint8_t flags;		/* always TELEMETRY_COUNTER */
+} __attribute__((packed));
+
+/* path is the log file, NULL to keep the samples in memory only. */
+void telemetry_init(const char *path);
+
+/* record the battery state, flushing once enough samples are pending. */
+void telemetry_add(const struct power_supply_status *battery, int charger);
+
+/* record the totals of a wakeup source. */
+void telemetry_add_counter(int id, unsigned long count,
+			   unsigned long long cpu_ns);
+
+/* write pending samples out now. returns 0 or -1. */
+int telemetry_flush(void);
+
+/* copy up to max of the newest samples, oldest first. returns the count. */
+int telemetry_snapshot(struct telemetry_sample *out, int max);
+int telemetry_counter_snapshot(struct telemetry_counter *out, int max);
+
+#endif
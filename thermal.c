@@ -0,0 +1,155 @@
+/*************************************************************************
+ * Copyright(c) 2012 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * **************************************************************************/
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+
+#include "thermal.h"
+
+#define THERMAL_PATH_SIZ	255
+#define THERMAL_MAX_TRIPS	16
+
+/* read a short sysfs attribute, without the trailing newline */
+static int read_attr(const char *path, char *buf, int size)
+{
+	int fd, len;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -1;
+	len = read(fd, buf, size - 1);
+	close(fd);
+	if (len <= 0)
+		return -1;
+	while (len > 0 && buf[len - 1] == '\n')
+		len--;
+	buf[len] = '\0';
+	return len;
+}
+
+/* the SoC and the battery can power the device off. skin and board
+   sensors have trips meant for throttling, well below what harms the
+   hardware, and only report. thermal_zone0, the one zone watched
+   before, always counts. */
+static int zone_guarded(const char *name, const char *type)
+{
+	static const char *const guarded[] = { "soc", "cpu", "core", "bat" };
+	char lower[32];
+	unsigned i;
+
+	if (!strcmp(name, "thermal_zone0"))
+		return 1;
+	for (i = 0; type[i] && i < sizeof(lower) - 1; i++)
+		lower[i] = tolower((unsigned char)type[i]);
+	lower[i] = '\0';
+	for (i = 0; i < sizeof(guarded) / sizeof(guarded[0]); i++)
+		if (strstr(lower, guarded[i]))
+			return 1;
+	return 0;
+}
+
+static int zone_limit(const char *name)
+{
+	char path[THERMAL_PATH_SIZ], buf[32];
+	int i, temp, limit = 0;
+
+	for (i = 0; i < THERMAL_MAX_TRIPS; i++) {
+		snprintf(path, sizeof(path),
+			 SYSFS_THERMAL "/%s/trip_point_%d_type", name, i);
+		if (read_attr(path, buf, sizeof(buf)) < 0)
+			break;
+		/* passive and active trips are cooling hints, not limits */
+		if (strcmp(buf, "hot") && strcmp(buf, "critical"))
+			continue;
+		snprintf(path, sizeof(path),
+			 SYSFS_THERMAL "/%s/trip_point_%d_temp", name, i);
+		if (read_attr(path, buf, sizeof(buf)) < 0 ||
+		    sscanf(buf, "%d", &temp) != 1 || temp <= 0)
+			continue;
+		if (limit == 0 || temp < limit)
+			limit = temp;
+	}
+	if (limit == 0 || limit > THERMAL_LIMIT_CAP)
+		limit = THERMAL_LIMIT_CAP;
+	return limit;
+}
+
+int thermal_open(struct thermal *th)
+{
+	char path[THERMAL_PATH_SIZ];
+	struct thermal_zone *z;
+	struct dirent *de;
+	DIR *dir;
+
+	th->count = 0;
+	if ((dir = opendir(SYSFS_THERMAL)) == NULL)
+		return -1;
+	while ((de = readdir(dir)) != NULL && th->count < THERMAL_MAX_ZONES) {
+		if (strncmp(de->d_name, "thermal_zone", 12))
+			continue;
+		z = &th->zone[th->count];
+		snprintf(path, sizeof(path), SYSFS_THERMAL "/%s/temp",
+			 de->d_name);
+		if ((z->fd = open(path, O_RDONLY)) < 0)
+			continue;
+		snprintf(path, sizeof(path), SYSFS_THERMAL "/%s/type",
+			 de->d_name);
+		if (read_attr(path, z->type, sizeof(z->type)) < 0)
+			snprintf(z->type, sizeof(z->type), "%s", de->d_name);
+		z->limit = zone_guarded(de->d_name, z->type) ?
+			zone_limit(de->d_name) : 0;
+		z->temp = 0;
+		th->count++;
+	}
+	closedir(dir);
+	if (th->count == 0) {
+		errno = ENOENT;
+		return -1;
+	}
+	return th->count;
+}
+
+int thermal_read(struct thermal *th)
+{
+	char buf[16];
+	int i, len, worst = -1;
+
+	for (i = 0; i < th->count; i++) {
+		len = pread(th->zone[i].fd, buf, sizeof(buf) - 1, 0);
+		if (len <= 0)
+			continue;
+		buf[len] = '\0';
+		if (sscanf(buf, "%d", &th->zone[i].temp) != 1 ||
+		    th->zone[i].limit == 0)
+			continue;
+		if (worst < 0 ||
+		    th->zone[i].limit - th->zone[i].temp <
+		    th->zone[worst].limit - th->zone[worst].temp)
+			worst = i;
+	}
+	return worst;
+}
+
+void thermal_close(struct thermal *th)
+{
+	int i;
+
+	for (i = 0; i < th->count; i++)
+		close(th->zone[i].fd);
+	th->count = 0;
+}
@@ -0,0 +1,48 @@
+/*************************************************************************
+ * Copyright(c) 2012 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * **************************************************************************/
+#ifndef THERMAL_H
+#define THERMAL_H
+
+#define SYSFS_THERMAL		"/sys/class/thermal"
+#define THERMAL_MAX_ZONES	8
+/* shutdown limit of the SoC and battery zones, lower trips win */
+#define THERMAL_LIMIT_CAP	73000
+
+struct thermal_zone {
+	char type[32];
+	int fd;			/* temp attribute, kept open */
+	/* lowest hot or critical trip, capped, in mC. 0 for a zone
+	   that only reports, see zone_guarded() */
+	int limit;
+	int temp;		/* last reading, in mC */
+};
+
+struct thermal {
+	int count;
+	struct thermal_zone zone[THERMAL_MAX_ZONES];
+};
+
+/* find every thermal_zone in sysfs and read the trip points of the
+   SoC and battery zones. returns the number of zones, or -1 if there
+   is none. */
+int thermal_open(struct thermal *th);
+
+/* refresh the temperature of every zone. returns the index of the zone
+   with a limit closest to it, or -1 if no such zone could be read. */
+int thermal_read(struct thermal *th);
+
+void thermal_close(struct thermal *th);
+
+#endif
@@ -0,0 +1,190 @@
+/*************************************************************************
+ * Copyright(c) 2012 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * **************************************************************************/
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include <linux/netlink.h>
+
+#include "uevent.h"
+
+#define UEVENT_MSG_LEN		2048
+/* kernel events are multicast on group 1, udevd re-broadcasts on 2 */
+#define UEVENT_KERNEL_GROUP	1
+/* how far into "action@devpath" the filter looks for "/<subsystem>" */
+#define UEVENT_FILTER_SCAN	256
+/* leading bytes of "/<subsystem>" compared by the filter */
+#define UEVENT_FILTER_PAT	8
+/* worst case is 3 load/compare pairs (4+2+1 bytes) plus the accept */
+#define UEVENT_FILTER_MAX	(UEVENT_FILTER_SCAN * 7 + 1)
+
+static long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/*
+ * Classic BPF cannot loop, so the search for "/<subsystem>" in the
+ * devpath is unrolled over every start offset. At each offset the
+ * pattern is compared in word/half/byte loads, a mismatch jumps to the
+ * next offset and a full match accepts the packet. A load past the end
+ * of the message ends the program and drops it.
+ */
+static int build_filter(struct sock_filter *f, const char *subsystem)
+{
+	unsigned char pat[UEVENT_FILTER_PAT];
+	int plen, off, k, step, pairs, left, n = 0;
+	unsigned size, val;
+
+	pat[0] = '/';
+	plen = strlen(subsystem) + 1;
+	if (plen > UEVENT_FILTER_PAT)
+		plen = UEVENT_FILTER_PAT;
+	memcpy(pat + 1, subsystem, plen - 1);
+
+	for (pairs = 0, k = 0; k < plen; k += step, pairs++)
+		step = plen - k >= 4 ? 4 : plen - k >= 2 ? 2 : 1;
+
+	for (off = 0; off < UEVENT_FILTER_SCAN; off++) {
+		left = pairs;
+		for (k = 0; k < plen; k += step) {
+			step = plen - k >= 4 ? 4 : plen - k >= 2 ? 2 : 1;
+			switch (step) {
+			case 4:
+				size = BPF_W;
+				val = pat[k] << 24 | pat[k + 1] << 16 |
+					pat[k + 2] << 8 | pat[k + 3];
+				break;
+			case 2:
+				size = BPF_H;
+				val = pat[k] << 8 | pat[k + 1];
+				break;
+			default:
+				size = BPF_B;
+				val = pat[k];
+				break;
+			}
+			left--;
+			f[n++] = (struct sock_filter)
+				BPF_STMT(BPF_LD | size | BPF_ABS, off + k);
+			/* on mismatch skip the remaining pairs and the accept */
+			f[n++] = (struct sock_filter)
+				BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, val, 0,
+					 2 * left + 1);
+		}
+		f[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+	}
+	f[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, 0);
+	return n;
+}
+
+int uevent_open(struct uevent_listener *ul, const char *subsystem)
+{
+	struct sock_filter insns[UEVENT_FILTER_MAX];
+	struct sock_fprog prog;
+	struct sockaddr_nl nls;
+
+	snprintf(ul->match, sizeof(ul->match), "SUBSYSTEM=%s", subsystem);
+	ul->fd = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT);
+	if (ul->fd < 0)
+		return -1;
+
+	/* without the filter we still work, just with more wakeups */
+	prog.len = build_filter(insns, subsystem);
+	prog.filter = insns;
+	setsockopt(ul->fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+
+	/* nl_pid 0 lets the kernel pick, several listeners may share a process */
+	memset(&nls, 0, sizeof(nls));
+	nls.nl_family = AF_NETLINK;
+	nls.nl_groups = UEVENT_KERNEL_GROUP;
+	if (bind(ul->fd, (void *)&nls, sizeof(nls))) {
+		close(ul->fd);
+		ul->fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+void uevent_close(struct uevent_listener *ul)
+{
+	if (ul->fd >= 0)
+		close(ul->fd);
+	ul->fd = -1;
+}
+
+/* read one message. returns 1 if it is for our subsystem, 0 if not
+   or nothing is queued, -1 on error */
+static int uevent_recv(struct uevent_listener *ul)
+{
+	char buf[UEVENT_MSG_LEN];
+	int i, len, mlen = strlen(ul->match);
+
+	len = recv(ul->fd, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+	if (len < 0)
+		return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+	buf[len] = '\0';
+
+	for (i = 0; i < len; i += strlen(buf + i) + 1) {
+		if (!strncmp(buf + i, ul->match, mlen) && buf[i + mlen] == '\0')
+			return 1;
+	}
+	return 0;
+}
+
+int uevent_wait(struct uevent_listener *ul, int timeout_ms, int window_ms)
+{
+	struct pollfd pfd;
+	long deadline, now;
+	int count = 0, wait, ret;
+
+	pfd.fd = ul->fd;
+	pfd.events = POLLIN;
+	deadline = timeout_ms < 0 ? -1 : now_ms() + timeout_ms;
+
+	for (;;) {
+		now = now_ms();
+		if (deadline < 0)
+			wait = -1;
+		else if ((wait = deadline - now) < 0)
+			wait = 0;
+
+		ret = poll(&pfd, 1, wait);
+		if (ret < 0 && errno != EINTR)
+			return -1;
+		if (ret == 0 && wait == 0)
+			break;
+		if (ret <= 0)
+			continue;
+
+		if ((ret = uevent_recv(ul)) < 0)
+			return -1;
+		/* the first event opens the coalescing window */
+		if (ret && count++ == 0)
+			deadline = now_ms() + window_ms;
+	}
+
+	/* pick up whatever is still queued so it does not open a new window */
+	while (count && (ret = uevent_recv(ul)) > 0)
+		count++;
+	return count;
+}
@@ -0,0 +1,42 @@
+/*************************************************************************
+ * Copyright(c) 2012 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * **************************************************************************/
+#ifndef UEVENT_H
+#define UEVENT_H
+
+/* events closer together than this are reported as one */
+#define UEVENT_DEBOUNCE_MS	200
+
+struct uevent_listener {
+	int fd;
+	char match[64];		/* "SUBSYSTEM=<name>" */
+};
+
+/*
+ * Open a kernel uevent socket for one subsystem. A socket filter drops
+ * every other event in the kernel, so the owner is only woken up for
+ * the devices it cares about. Returns 0 or -1.
+ */
+int uevent_open(struct uevent_listener *ul, const char *subsystem);
+
+/*
+ * Wait up to timeout_ms (-1 for ever) for an event of the subsystem,
+ * then keep draining until window_ms have passed since the first one.
+ * Returns the number of events seen, 0 on timeout, -1 on error.
+ */
+int uevent_wait(struct uevent_listener *ul, int timeout_ms, int window_ms);
+
+void uevent_close(struct uevent_listener *ul);
+
+#endif
@@ -0,0 +1,242 @@
+/*************************************************************************
+ * Copyright(c) 2012 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * **************************************************************************/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <direct/mem.h>
+
+#include <lite/util.h>
+
+#include "imagecache.h"
+
+struct _CachedImage {
+     CachedImage           *next;
+     char                  *filename;
+     DFBSurfacePixelFormat  format;
+     IDirectFBSurface      *surface;
+     int                    refs;
+};
+
+struct _LiteCachedImage {
+     LiteBox                box;
+     DFBSurfacePixelFormat  format;     /* of the window it is drawn to */
+     CachedImage           *image;
+};
+
+static DFBResult draw_cached_image(LiteBox *box, const DFBRegion *region, DFBBoolean clear);
+static DFBResult destroy_cached_image(LiteBox *box);
+
+/* the UI threads load images concurrently, the lock also keeps two of
+   them from decoding the same file */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static CachedImage *cache = NULL;
+
+DFBResult
+image_cache_get(const char            *filename,
+                DFBSurfacePixelFormat  format,
+                CachedImage          **ret_image)
+{
+     DFBResult    res;
+     CachedImage *image;
+     int          width, height;
+
+     LITE_NULL_PARAMETER_CHECK(filename);
+     LITE_NULL_PARAMETER_CHECK(ret_image);
+
+     pthread_mutex_lock(&cache_lock);
+
+     for (image = cache; image; image = image->next) {
+          if (image->format == format && !strcmp(image->filename, filename))
+               break;
+     }
+
+     if (!image) {
+          image = D_CALLOC(1, sizeof(CachedImage));
+          if (!image) {
+               pthread_mutex_unlock(&cache_lock);
+               return DFB_NOSYSTEMMEMORY;
+          }
+
+          res = lite_util_load_image(filename, format, &image->surface,
+                                     &width, &height, NULL);
+          if (res != DFB_OK) {
+               pthread_mutex_unlock(&cache_lock);
+               D_FREE(image);
+               return res;
+          }
+
+          image->filename = D_STRDUP(filename);
+          image->format   = format;
+          image->next     = cache;
+          cache = image;
+     }
+
+     image->refs++;
+
+     pthread_mutex_unlock(&cache_lock);
+
+     *ret_image = image;
+
+     return DFB_OK;
+}
+
+void
+image_cache_put(CachedImage *image)
+{
+     if (!image)
+          return;
+
+     pthread_mutex_lock(&cache_lock);
+     image->refs--;
+     pthread_mutex_unlock(&cache_lock);
+}
+
+void
+image_cache_flush(void)
+{
+     CachedImage **link, *image;
+
+     pthread_mutex_lock(&cache_lock);
+
+     for (link = &cache; (image = *link) != NULL; ) {
+          if (image->refs) {
+               link = &image->next;
+               continue;
+          }
+
+          *link = image->next;
+
+          image->surface->Release(image->surface);
+          D_FREE(image->filename);
+          D_FREE(image);
+     }
+
+     pthread_mutex_unlock(&cache_lock);
+}
+
+DFBResult
+lite_new_cached_image(LiteBox          *parent,
+                      DFBRectangle     *rect,
+                      LiteCachedImage **ret_image)
+{
+     DFBResult        res;
+     LiteCachedImage *image = NULL;
+
+     LITE_NULL_PARAMETER_CHECK(parent);
+     LITE_NULL_PARAMETER_CHECK(rect);
+     LITE_NULL_PARAMETER_CHECK(ret_image);
+
+     image = D_CALLOC(1, sizeof(LiteCachedImage));
+
+     image->box.parent = parent;
+     image->box.rect   = *rect;
+
+     res = lite_init_box(LITE_BOX(image));
+     if (res != DFB_OK) {
+          D_FREE(image);
+          return res;
+     }
+
+     image->box.type    = LITE_TYPE_CACHED_IMAGE;
+     image->box.Draw    = draw_cached_image;
+     image->box.Destroy = destroy_cached_image;
+
+     /* decode straight into the window format, a draw is a plain blit */
+     image->box.surface->GetPixelFormat(image->box.surface, &image->format);
+
+     *ret_image = image;
+
+     return DFB_OK;
+}
+
+DFBResult
+lite_set_cached_image(LiteCachedImage *image, const char *filename)
+{
+     DFBResult    res;
+     CachedImage *cached, *old;
+
+     LITE_NULL_PARAMETER_CHECK(image);
+     LITE_BOX_TYPE_PARAMETER_CHECK(LITE_BOX(image), LITE_TYPE_CACHED_IMAGE);
+
+     res = image_cache_get(filename, image->format, &cached);
+     if (res != DFB_OK)
+          return res;
+
+     old = image->image;
+     if (cached == old) {
+          image_cache_put(cached);
+          return DFB_OK;
+     }
+
+     /* a surface stays cached after its last reference is put, a draw
+        still blitting the old one in another thread is safe */
+     image->image = cached;
+     image_cache_put(old);
+
+     return lite_update_box(LITE_BOX(image), NULL);
+}
+
+DFBResult
+lite_preload_cached_image(LiteCachedImage *image, const char *filename)
+{
+     DFBResult    res;
+     CachedImage *cached;
+
+     LITE_NULL_PARAMETER_CHECK(image);
+     LITE_BOX_TYPE_PARAMETER_CHECK(LITE_BOX(image), LITE_TYPE_CACHED_IMAGE);
+
+     res = image_cache_get(filename, image->format, &cached);
+     if (res == DFB_OK)
+          image_cache_put(cached);
+
+     return res;
+}
+
+/* internals */
+
+static DFBResult
+draw_cached_image(LiteBox         *box,
+                  const DFBRegion *region,
+                  DFBBoolean       clear)
+{
+     IDirectFBSurface *surface = box->surface;
+     CachedImage      *cached  = LITE_CACHED_IMAGE(box)->image;
+
+     D_ASSERT(box != NULL);
+
+     surface->SetClip(surface, region);
+
+     if (clear)
+          lite_clear_box(box, region);
+
+     if (cached) {
+          surface->SetBlittingFlags(surface, DSBLIT_BLEND_ALPHACHANNEL);
+          surface->StretchBlit(surface, cached->surface, NULL, NULL);
+     }
+
+     return DFB_OK;
+}
+
+static DFBResult
+destroy_cached_image(LiteBox *box)
+{
+     D_ASSERT(box != NULL);
+
+     image_cache_put(LITE_CACHED_IMAGE(box)->image);
+
+     return lite_destroy_box(box);
+}
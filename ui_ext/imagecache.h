@@ -0,0 +1,66 @@
+/*************************************************************************
+ * Copyright(c) 2012 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * **************************************************************************/
+
+#ifndef __IMAGECACHE_H__
+#define __IMAGECACHE_H__
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <lite/box.h>
+
+/*
+ * Decoded images shared by file name. A file is decoded once, into a
+ * surface in the pixel format it is drawn to, and stays cached until
+ * image_cache_flush(); image_cache_get() hands out a reference that
+ * image_cache_put() returns.
+ */
+typedef struct _CachedImage CachedImage;
+
+DFBResult image_cache_get(const char            *filename,
+                          DFBSurfacePixelFormat  format,
+                          CachedImage          **ret_image);
+void image_cache_put(CachedImage *image);
+
+/* release the surfaces nobody holds a reference on */
+void image_cache_flush(void);
+
+/*
+ * A LiteImage drawn from the cache: switching it to another file
+ * decodes nothing once the file was seen, and switching it to the
+ * file it already shows does not redraw.
+ */
+#define LITE_TYPE_CACHED_IMAGE  (LITE_TYPE_BOX_USER + 1)
+#define LITE_CACHED_IMAGE(l)    ((LiteCachedImage*)(l))
+
+typedef struct _LiteCachedImage LiteCachedImage;
+
+DFBResult lite_new_cached_image(LiteBox          *parent,
+                                DFBRectangle     *rect,
+                                LiteCachedImage **ret_image);
+
+DFBResult lite_set_cached_image(LiteCachedImage *image, const char *filename);
+
+/* decode filename for this widget ahead of its first use */
+DFBResult lite_preload_cached_image(LiteCachedImage *image,
+                                    const char      *filename);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*  __IMAGECACHE_H__  */
@@ -156,16 +156,30 @@ lite_set_textedit_focus(LiteTextEdit *textedit, const bool on)
      return DFB_OK;
 }
 
-#define TOTAL_BUF_SIZE      (5*1024*1024)
-char str[TOTAL_BUF_SIZE] = {'\0', };
+/* the text is appended to what came before, and only its last
+   MAX_SIZE bytes are ever drawn: keep no more than that */
+char str[MAX_SIZE + 1] = {'\0', };
 DFBResult 
 lite_set_textedit_text(LiteTextEdit *textedit, const char *text)
 {
+     size_t len, add;
+
      LITE_NULL_PARAMETER_CHECK(textedit);
      LITE_BOX_TYPE_PARAMETER_CHECK(LITE_BOX(textedit), LITE_TYPE_TEXTLINE);
      LITE_NULL_PARAMETER_CHECK(text);
 
-     strcat(str, text);
+     len = strlen(str);
+     add = strlen(text);
+     if (add >= MAX_SIZE) {
+          memcpy(str, text + add - MAX_SIZE, MAX_SIZE + 1);
+     }
+     else {
+          if (len + add > MAX_SIZE) {
+               memmove(str, str + len + add - MAX_SIZE, MAX_SIZE - add);
+               len = MAX_SIZE - add;
+          }
+          memcpy(str + len, text, add + 1);
+     }
      text = str;
 
      if (!strcmp(textedit->text, text)) {
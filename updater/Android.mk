@@ -9,7 +9,7 @@ include $(CLEAR_VARS)
 
 LOCAL_MODULE_TAGS := optional
 
-LOCAL_SRC_FILES := recovery_updater.c ifwi_update.c
+LOCAL_SRC_FILES := recovery_updater.c ifwi_update.c ../scu_ipc.c
 LOCAL_C_INCLUDES += bootable/recovery
 LOCAL_MODULE := librecovery_updater_intel
 LOCAL_C_INCLUDES += bionic/libc/private
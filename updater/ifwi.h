@@ -61,7 +61,4 @@ struct FIP_header{
 	struct IFWI_rev ifwi_rev;
 };
 
-struct scu_ipc_version {
-	uint32  count;  /* length of version info */
-	uint8   data[16]; /* version data */
-};
+#include "../scu_ipc.h"
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -11,29 +12,18 @@
 #define IFWI_SYSFS_INT	 "/sys/devices/pci0000:00/0000:00:01.7/ifwi"
 #define PREP_SYSFS_INT	 "/sys/devices/pci0000:00/0000:00:01.7/scu_ipc/medfw_prepare"
 
-#define DEVICE_NAME "/dev/mid_ipc"
-#define INTE_SCU_IPC_FW_REVISION_GET  0xB0
 #define FIP_pattern 0x50494624
 #define IFWI_offset 36
 
 static int find_fw_rev(struct IFWI_rev *ifwi_version)
 {
-	int devfd, errNo;
 	struct scu_ipc_version version;
 
-	version.count = 16;    /*read back 16 bytes fw info from IPC*/
-	if ((devfd = open(DEVICE_NAME, O_RDWR)) == -1) {
-		fprintf(stderr, "unable to open the DEVICE %s\n", DEVICE_NAME);
+	if (scu_ipc_fw_version(&version) < 0) {
+		fprintf(stderr, "finding fw_info, ioctl for DEVICE %s, returns error-%d\n", IPC_DEVICE_NAME, errno);
 		return -1;
 	}
 
-	if ((errNo = ioctl(devfd, INTE_SCU_IPC_FW_REVISION_GET, &version)) < 0) {
-		fprintf(stderr, "finding fw_info, ioctl for DEVICE %s, returns error-%d\n", DEVICE_NAME, errNo);
-		return -1;
-	}
-
-	close(devfd);
-
 	ifwi_version->major = version.data[15];
 	ifwi_version->minor = version.data[14];
 	return 0;
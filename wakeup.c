@@ -0,0 +1,65 @@
+/*************************************************************************
+ * Copyright(c) 2012 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * **************************************************************************/
+#include <pthread.h>
+#include <stdio.h>
+
+#include "wakeup.h"
+
+static pthread_mutex_t list_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct wakeup_source *sources;
+
+void wakeup_begin(struct wakeup_source *ws, struct timespec *start)
+{
+	if (!ws->listed) {
+		pthread_mutex_lock(&list_lock);
+		if (!ws->listed) {
+			ws->next = sources;
+			sources = ws;
+			ws->listed = 1;
+		}
+		pthread_mutex_unlock(&list_lock);
+	}
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, start);
+}
+
+void wakeup_end(struct wakeup_source *ws, const struct timespec *start)
+{
+	struct timespec now;
+	long long ns;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	ns = (now.tv_sec - start->tv_sec) * 1000000000LL +
+		now.tv_nsec - start->tv_nsec;
+	/* a source may be served from more than one thread */
+	__sync_fetch_and_add(&ws->count, 1);
+	__sync_fetch_and_add(&ws->cpu_ns, ns);
+}
+
+void wakeup_each(void (*fn)(const struct wakeup_source *ws, void *data),
+		 void *data)
+{
+	struct wakeup_source *ws;
+
+	pthread_mutex_lock(&list_lock);
+	for (ws = sources; ws; ws = ws->next)
+		fn(ws, data);
+	pthread_mutex_unlock(&list_lock);
+}
+
+int wakeup_format(const struct wakeup_source *ws, char *buf, int size)
+{
+	return snprintf(buf, size, "%s %lu %llu.%03llums", ws->name, ws->count,
+			ws->cpu_ns / 1000000, ws->cpu_ns / 1000 % 1000);
+}
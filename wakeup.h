@@ -0,0 +1,73 @@
+/*************************************************************************
+ * Copyright(c) 2012 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * **************************************************************************/
+#ifndef WAKEUP_H
+#define WAKEUP_H
+
+#include <time.h>
+
+/*
+ * Wakeup accounting for the charging paths. Every timer, thread loop
+ * or fd handler brackets the work it does for one wakeup with
+ * wakeup_begin()/wakeup_end(), which count it and add the CPU time the
+ * thread spent. The counters are listed by the debug dumps and logged
+ * to the telemetry file, so the sources keeping the SoC awake can be
+ * found from data.
+ */
+
+/* stable ids, as written to the telemetry log */
+enum {
+	WAKEUP_FB_BATTERY_TIMER = 1,	/* fastboot battery icon */
+	WAKEUP_FB_POWER_POLL,		/* fastboot charger/battery poll */
+	WAKEUP_FB_REBOOT_TIMER,		/* fastboot COS power key */
+	WAKEUP_FB_GATE_WAIT,		/* fastboot POS voltage gate wait */
+	WAKEUP_COS_INPUT,		/* COS daemon sources */
+	WAKEUP_COS_POWER_UEVENT,
+	WAKEUP_COS_POWER_REFRESH,
+	WAKEUP_COS_POWER_OFF,
+	WAKEUP_COS_RTC,
+	WAKEUP_COS_THERMAL_UEVENT,
+	WAKEUP_COS_THERMAL_TIMER,
+	WAKEUP_COS_LONGPRESS,
+	WAKEUP_COS_SCREEN_OFF,
+	WAKEUP_COS_DUMP,
+	WAKEUP_COS_UI_EVENTS,		/* COS UI threads */
+	WAKEUP_COS_UI_REFRESH,
+	WAKEUP_COS_SUSPEND_CHECK,	/* COS status check while suspended */
+	WAKEUP_COS_THERMAL_OFF,		/* COS over temperature shutdown */
+};
+
+struct wakeup_source {
+	const char *name;
+	int id;
+	unsigned long count;
+	unsigned long long cpu_ns;	/* thread CPU time */
+	/* list of the sources seen so far, filled on first use */
+	struct wakeup_source *next;
+	int listed;
+};
+
+#define WAKEUP_SOURCE_INIT(_id, _name)	{ .name = (_name), .id = (_id) }
+
+void wakeup_begin(struct wakeup_source *ws, struct timespec *start);
+void wakeup_end(struct wakeup_source *ws, const struct timespec *start);
+
+/* call fn for every source used so far */
+void wakeup_each(void (*fn)(const struct wakeup_source *ws, void *data),
+		 void *data);
+
+/* "<name> <count> <cpu ms>", returns the length */
+int wakeup_format(const struct wakeup_source *ws, char *buf, int size);
+
+#endif